@@ -6,329 +6,41 @@
 
 #include <SDL2/SDL.h>
 
+#include "chip8.h"
+#include "chip8_audio.h"
+#include "chip8_movie.h"
+#include "chip8_romdb.h"
+
 // SDL VARIABLES
 char* TITLE = "CHIP-8";
-uint16_t WIDTH = 64;
-uint16_t HEIGHT = 32;
-uint8_t FG_COLOUR = 0xFF; // WHITE
-uint8_t BG_COLOUR = 0x00; // BLACK
+uint16_t WIDTH = DISPLAY_WIDTH;
+uint16_t HEIGHT = DISPLAY_HEIGHT;
+uint8_t PALETTE[4] = {0x00, 0xFF, 0xAA, 0x55}; // grey level per pixel colour: BLACK background, WHITE plane 0, XO-CHIP plane 1, both planes
 uint8_t SCALE_FACTOR = 20;
+uint16_t AUDIO_BUFFER_SAMPLES = 512; // ~10ms at 48kHz, keeps the beep within a frame of the sound timer
+#define MAX_FRAME_SAMPLES (192000 / 60) // one frame of samples at the highest rate a device may give us
+#define MAX_RUN_AHEAD 8 // frames
+#define LATENCY_SAMPLES 1024 // key presses kept for the latency percentiles, the newest replace the oldest
 
-// CHIP-8 SPECIFICATIONS
-uint8_t ram[4096]; // 4kb RAM
-bool display[64*32]; // CHIP-8 display was 64 x 32 pixels, with each pixel being either on (true/white) or off (false/black)
-bool keyboard[16]; // CHIP-8 Keyboard is a hex keyboard
-uint16_t stack[12]; // The original RCA 1802 version allocated 48 bytes for up to 12 levels of nesting
-uint8_t cur_stack; // points to the current stack
-uint8_t data_registers[16]; // CHIP-8 has 16 8-bit data registers V0-VF 
-uint16_t I; // 12-bit address register used with several opcodes that involve memory operations
-uint16_t PC; // store memory address of instruction to be executed next
-typedef struct {
-    uint16_t opcode;
-    uint16_t NNN; // 12-bit address
-    uint8_t NN;  // 8-bit constant
-    uint8_t N;  // 4-bit constant
-    uint8_t X; // 4-bit register identifier
-    uint8_t Y;// 4-bit register identifier
-} instruction;
-
-// BOTH TIMERS COUNT DOWN at 60Hz, UNTIL THEY REACH 0
-uint8_t delay_timer; // used for timing the events of game. can be set and read
-uint8_t sound_timer; // used for sound effects, a beeping sound is made when this is not zero
-
-bool keyboard_input[16]; // input is done with a hex keyboard with keys ranging from 0-F
-
-char* rom; // name of the rom that will be executed
-
-uint16_t BEGIN_LOCATION = 512; // original CHIP-8 occupies first 512 bytes, so most programs start at memory location 512, this convention will be followed here
-uint8_t fonts[] = { // Hex representation of hex characters that are 4 pixels wide and 5 pixels tall
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1      Example representation of 0:
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3                11110000 <-- 0xF0
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4                10010000 <-- 0x90
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5                10010000
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6                10010000
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7                11110000
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9       If you look at the outline
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A       of the 1's you can see the 0
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
-
-// return success status of CHIP-8 initialization
-bool init_chip8(char* rom_file)
-{
-    // load the fonts into the memory, starting from address 0x00
-    memcpy(&ram[0], fonts, sizeof(fonts));
-
-    // open ROM, whose name can be passed in from the command line
-    FILE *rom = fopen(rom_file, "rb");
-    if (!rom)
-    {
-        SDL_Log("Could not find file %s", rom_file);
-        return false;
-    }
-    // get file size
-    fseek(rom, 0, SEEK_END);
-    long file_size = ftell(rom);
-
-    long max_size = sizeof(ram) - BEGIN_LOCATION;
-    rewind(rom); // rewind to beginning of file, don't want to be at the end of file because of above fseek
-
-    if(file_size > max_size) // file is bigger than memory, can't load it
-    {
-        SDL_Log("File %s is too large. ROM size: %ld, Max size: %ld\n", rom_file, file_size, max_size);
-        return false;
-    }
-
-    // load ROM
-    if (fread(&ram[BEGIN_LOCATION], file_size, 1, rom) != 1)
-    {
-        SDL_Log("Could not load file %s into memory\n", rom_file);
-        return false;
-    }
-    
-    PC = BEGIN_LOCATION;
-    // initialize stack pointer to 0
-    cur_stack = 0;
-    fclose(rom);
-    return true;
-}
-
-void execute_instruction(instruction *instr)
-{
-    // fetch instruction from RAM
-    uint16_t big_endian_opcode = ram[PC] << 8 | ram[PC + 1]; // this was done on x64 architecture which is little endian. Needed to convert opcode to big endian to match CHIP-8 system specs.
-    instr->opcode = big_endian_opcode;
-    PC += 2; // increment PC by 2 to start at next instruction (1 instruction is 2 bytes)
-
-    // instruction format
-    instr->N= instr->opcode & 0x0F;
-    instr->NN= instr->opcode & 0x0FF;
-    instr->NNN = instr->opcode & 0x0FFF;
-    instr->X = (instr->opcode >> 8)& 0x0F;
-    instr->Y = (instr->opcode >> 4) & 0x0F;
-    // printf("%04X %04X\n", PC ,instr->opcode);
-    // Emulate opcodes
-    switch((instr->opcode >> 12) & 0x0F){ // mask off first number in opcode
-        case 0x0:
-            if(instr->NN == 0xE0){ // 00E0 (clear the screen)
-                memset(&display[0], false, sizeof(display));
-            }
-            else if (instr->NN == 0xEE) // 00EE (return from subroutine)
-            {
-                cur_stack--; // pop the subroutine from the stack
-                PC = stack[cur_stack]; // PC now points to next instruction in the stack
-                // printf("Return from subroutine to address 0x%04X\n",
-                    //    (stack[cur_stack - 1]));
-            }
-            break;
-        case 0x01: // 1NNN (jump to address NNN)
-            PC = instr->NNN;
-            // printf("Jump to address NNN (0x%04X)\n",
-                //    instr->NNN);  
-            break;
-
-        case 0x02: // only 0x02 instruction is 2NNN (call subroutine at address NNN)
-            stack[cur_stack] = PC; // save current PC so we can return to it later
-            cur_stack++; // increment stack pointer by one
-            PC = instr->NNN; // jump to subroutine
-            // printf("Call subroutine at NNN (0x%04X)\n",
-            //        instr->NNN);
-            break;
-        case 0x03: // 3XNN (Skip next instruction if VX == NN)
-            PC += data_registers[instr->X] == instr->NN ? 2 : 0; // skip to the next instruction
-            break;
-        case 0x04: // 4XNN (Skip next instruction if VX != NN)
-            PC += data_registers[instr->X] != instr->NN ? 2 : 0; // skip to the next instruction
-            break;
-        case 0x05: // 5XY0 (Skip next instruction if VX == VY)
-            PC += data_registers[instr->X] == data_registers[instr->Y]? 2 : 0; // skip to the next instruction
-            break;
-        case 0x06: // 6XNN (Sets VX to NN)
-            data_registers[instr->X] = instr->NN;
-            // printf("Set register V%X = NN (0x%02X)\n",
-            //        instr->X, instr->NN);
-                   break;
-        case 0x07: // 7XNN (Adds NN to)
-            data_registers[instr->X] += instr->NN; 
-            // printf("Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n",
-            //        instr->X, data_registers[instr->X], instr->NN,
-            //        data_registers[instr->X] + instr->NN);
-            break;
-        case 0x08:
-            switch(instr->N){// there are many 0x08 instructions, need further decoding than just the first nibble
-                case 0x00:
-                    data_registers[instr->X] = data_registers[instr->Y]; // 8XY0 (VX is set to the value of VY)
-                    break;
-                case 0x01:
-                    data_registers[instr->X] |= data_registers[instr->Y]; // 8XY1 (VX is set to VX OR VY)
-                    break;
-                case 0x02:
-                    data_registers[instr->X] &= data_registers[instr->Y]; // 8XY2 (VX is set to VX AND VY)
-                    break;
-                case 0x03:
-                    data_registers[instr->X] ^= data_registers[instr->Y]; // 8XY3 (VX is set to VX XOR VY)
-                    break;
-                case 0x04:
-                    data_registers[instr->X] += data_registers[instr->Y]; // 8XY4 (VX is set to VX + VY)
-                    data_registers[0xF] = data_registers[instr->X] < data_registers[instr->Y]; // if an overflow ocurred, set carry flag VF to 1, otherwise set it to 0
-                    break;
-                case 0x05: // 8XY5 (VX is set to VX - VY)
-                    data_registers[0xF] = data_registers[instr->X] > data_registers[instr->Y]; // set carry flag to 1 if no underflow will occur, otherwise set to 0
-                    data_registers[instr->X] -= data_registers[instr->Y];
-                    break;
-                case 0x06: // 8XY6 (VX is set to VY >> 1)
-                    data_registers[0x0F] = data_registers[instr->X] & 1; // set carry flag to the bit that will be shifted out
-                    data_registers[instr->X] = data_registers[instr->Y] >> 1;
-                    break;
-                case 0x07: // 8XY7 (VX is set to VY - VX)
-                    data_registers[0xF] = data_registers[instr->X] < data_registers[instr->Y]; // set carry flag to 1 if no underflow will occur, otherwise set to 0
-                    data_registers[instr->X] = data_registers[instr->Y] - data_registers[instr->X];
-                    break;
-                case 0x0E: // 8XYE (VX is set to VY >> 1)
-                    data_registers[0x0F] = data_registers[instr->X] & 0x80; // set carry flag to the bit that will be shifted out
-                    data_registers[instr->X] = data_registers[instr->Y] << 1;
-                    break;
-            }
-            break;
-        case 0x09: // 9XY0 (Skip next instruction if VX != VY)
-            PC += data_registers[instr->X] != data_registers[instr->Y]? 2 : 0; // skip to the next instruction
-            break;
-        case 0x0A: // ANNN (Set I to address NNN)
-            I = instr->NNN;
-            // printf("Set I to NNN (0x%04X)\n",
-            //        instr->NNN);
-            break;
-        case 0x0B: // BNN (Jump to address NNN plus V))
-            PC = instr->NNN + data_registers[0];
-            break;
-        case 0x0C: // CXNN (Generate a random number, binary AND it with NN, and store result in vX)
-            data_registers[instr->X] = (rand() % instr->NN) & instr->NN;  
-            break;
-        case 0x0D: ;// DXYN (Display: draw a sprite at coordinate (VX, VY). sprite details mentioned below)
-            // get coordinates
-            uint8_t orig_x = data_registers[instr->X] & (WIDTH - 1); // if coordinates exceed window width/height, wrap them around with modulo (aka bitwise AND)
-            uint8_t y = data_registers[instr->Y] & (HEIGHT - 1);
-            data_registers[0xF] = 0; // initialize carry flag to 0
-
-            // Sprite has N rows, loop over them
-            for(int i = 0; i < instr->N; i++)
-            {
-                uint8_t sprite_data = ram[I + i];
-                uint8_t x = orig_x;
-
-                // for each row:
-                for(int j = 7; j >= 0; j--){ // each row has 8 pixels
-                    bool pixel = display[y*WIDTH + x]; // convert 2D coordinates to 1D for the array
-                    if((sprite_data & (1 << j)) && pixel){ // if current pixel in the sprite row is on and the pixel at coordinates X,Y is on, turn off the pixel and set VF to 1
-                        data_registers[0xF] = 1; // set flag register to 1 if both the current sprite pixel and pixel at VX VY is set to true
-                    }
-                    // XOR the sprite pixel with the display pixel
-                    display[y*WIDTH + x] ^= sprite_data & (1 << j);
-
-                    // stop drawing if we hit the right edge of the sreen
-                    if(++x > WIDTH){
-                        break;
-                    }
-                }
-                // stop drawing if we hit the bottom edge of the sreen
-                if (++y >= WIDTH){
-                        break;
-                    }
-            }
-
-            // printf("Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) "
-            //        "from memory location I (0x%04X). Set VF = 1 if any pixels are turned off.\n",
-            //        instr->N, instr->X, data_registers[instr->X], instr->Y,
-            //        data_registers[instr->Y], I);
-            break;
-        case 0x0E:
-            switch (instr->NN)
-            {
-            case 0x9E: // EX9E (Skip one instruction if key corresponding to value VX is pressed)
-                PC += (keyboard[data_registers[instr->X]]) ? 2 : 0;
-            case 0xA1: // EXA1 (Skip one instruction if key corresponding to value VX is not pressed)
-                PC += (!keyboard[data_registers[instr->X]]) ? 2 : 0;
-            default:
-                break;
-            }
-        case 0x0F:
-        switch (instr->NN)
-        {
-            case 0x07: // FX07 (set VX to the current value of the delay timer)
-                data_registers[instr->X] = delay_timer;
-                break;
-            case 0x15: // FX07 (set delay timer to the current value of the VX)
-                delay_timer = data_registers[instr->X];
-                break;
-            case 0x18: // FX07 (set sound timer to the current value of the VX)
-                sound_timer = data_registers[instr->X];
-                break;
-            case 0x1E: // FX1E (Add the value of VX to index register I)
-                I += data_registers[instr->X]; // in the original COSMAC VIP, VF was not set even if there was overflow here
-                break;
-            case 0x0A: ;// FX0A (Stop executing instructions and wait until key input is received)
-                bool key_pressed = false;
-                uint8_t key;
-                for (unsigned int i = 0; i < sizeof(keyboard); i++){ // loop through keys and check if any of them have been pressed
-                    if (keyboard[i]){
-                        key_pressed = true;
-                        key = i; // store the pressed key, we will need it below
-                        break;
-                    }
-                }
-
-                if(!key_pressed){
-                    PC -= 2;
-                }
-                else{
-                    if(keyboard[key]){ // key is still being pressed, wait until it is released
-                        PC -= 2;
-                    }
-                    else{ // pressed key has been released, store it in VX
-                        data_registers[instr->X] = key;
-                    }
-                }
-                break;
-            case 0x29: // FX29 (I is set to the address of the hexadecimal character in VX)
-                I = data_registers[instr->X] * 5; // * 5 because one font sprite occupies 5 bytes of RAM
-                break;
-            case 0x33: ;// FX33 (Take number in VX and convert to threed separate decimal digits and store them in ram at address I, I + 1, and I + 2, respectively)
-                uint8_t n1,n2,n3;
-                n1 = instr->X / 100 % 10;
-                n2 = instr->X / 10 % 10;
-                n3 = instr->X % 10;
-                ram[I] = n1; ram[I + 1] = n2; ram[I + 2] = n3;
-                break;
-            case 0x55: // FX55 (Store V0...VX at address I...I+X, respectively)
-                for (int i = 0; i <= instr->X; i++)
-                {
-                     // two possible behaviours, increment I as we go, or don't. modern CHIP-8 interpreters don't, so this was the design chosen here.
-                     // could make some configuration for this part it is possible to also play older games
-                    ram[I + i] = data_registers[i];
-                }
-            case 0x65: // FX55 (Load into V0...VX the values at address I...I+X, respectively)
-                for (int i = 0; i <= instr->X; i++)
-                {
-                     // two possible behaviours, increment I as we go, or don't. modern CHIP-8 interpreters don't, so this was the design chosen here.
-                     // could make some configuration for this part it is possible to also play older games
-                     data_registers[i] = ram[I + i];
-                }
+audio_ring ring; // beeper samples, written by the emulation loop, drained by the audio callback
 
-            default:
-                break;
-            }
-            break;
-        default:
-            break; // unimplemented/invalid opcode
-    }
-}
+// Input-to-photon latency. A key press is timestamped when handle_input() drains it, counts as
+// observed in the first frame the program finds it held (EX9E/EXA1) or receives it (FX0A), and is
+// answered by the first presented frame from then on in which the program drew something.
+typedef struct {
+    uint64_t frame; // frames presented so far
+    uint64_t press_time[16];
+    uint64_t press_frame[16];
+    uint32_t observe_frames[16]; // frames from press to observation, for keys waiting for a present
+    uint16_t waiting_observe; // pressed, the program has not looked at them yet
+    uint16_t waiting_present; // observed, waiting for a display change to be presented
+    uint64_t latency_ns[LATENCY_SAMPLES]; // press to SDL_RenderPresent
+    uint32_t latency_frames[LATENCY_SAMPLES]; // press to observation
+    uint32_t count; // presses measured in total
+    uint32_t dropped; // presses released again before the program looked at them
+} latency_tracker;
+
+latency_tracker latency;
 
 // return success status of SDL initialization
 bool init_SDL(void){
@@ -352,180 +64,264 @@ SDL_Window *create_window(void){
 }
 
 // update changes to the window
-void update_screen(SDL_Renderer *renderer){
-    SDL_Rect rect = {.x=0, .y = 0, .w=SCALE_FACTOR, .h=SCALE_FACTOR}; // scale chip8 pixels by SCALE_FACTOR and draw them in SDL
-    
-    for (unsigned int i = 0; i < sizeof(display); i++)
-    {
-        rect.x = (i % WIDTH) * SCALE_FACTOR;
-        rect.y = (i / WIDTH) * SCALE_FACTOR;
-        // printf("rectangle coordinates: %d %d\n", rect.x, rect.y);
+void update_screen(SDL_Renderer *renderer, const chip8_machine *chip8){
+    unsigned int width = display_width(chip8), height = display_height(chip8);
+    int scale = SCALE_FACTOR * DISPLAY_WIDTH / width; // the window keeps its size, hi-res pixels are half as big
 
-        if (display[i]){ // pixel is on, draw foreground color
-            SDL_SetRenderDrawColor(renderer, FG_COLOUR, FG_COLOUR, FG_COLOUR, SDL_ALPHA_OPAQUE);
-        }
-        else{ // pixel is off, draw background color
-            SDL_SetRenderDrawColor(renderer, BG_COLOUR, BG_COLOUR, BG_COLOUR, SDL_ALPHA_OPAQUE);
+    SDL_SetRenderDrawColor(renderer, PALETTE[0], PALETTE[0], PALETTE[0], SDL_ALPHA_OPAQUE);
+    SDL_RenderClear(renderer);
+    for (unsigned int y = 0; y < height; y++)
+    {
+        // one rectangle per run of same coloured lit pixels instead of one per pixel
+        unsigned int x = 0;
+        while (x < width)
+        {
+            unsigned int colour = display_pixel(chip8, x, y);
+            if (!colour)
+            {
+                x++;
+                continue;
+            }
+            unsigned int start = x;
+            while (x < width && display_pixel(chip8, x, y) == colour)
+            {
+                x++;
+            }
+            SDL_SetRenderDrawColor(renderer, PALETTE[colour], PALETTE[colour], PALETTE[colour], SDL_ALPHA_OPAQUE);
+            SDL_Rect rect = {.x = start * scale, .y = y * scale, .w = (x - start) * scale, .h = scale};
+            SDL_RenderFillRect(renderer, &rect);
         }
-        SDL_RenderFillRect(renderer, &rect); 
     }
     SDL_RenderPresent(renderer);
 }
 
-// STILL NEEDS SOME WORK
-void handle_input(void)
+// Keypad layout: the keyboard key for each CHIP-8 key 0x0..0xF, as SDL key names. The default is
+// the usual 4x4 block on the left of a QWERTY keyboard:
+//   1 2 3 C      1 2 3 4
+//   4 5 6 D  ->  Q W E R
+//   7 8 9 E      A S D F
+//   A 0 B F      Z X C V
+#define DEFAULT_KEYMAP "X123QWEASDZC4RFV"
+
+// performance counter in nanoseconds, the clock used for audio and input latency measurements
+uint64_t ticks_ns(void) {
+    return (uint64_t)((double)SDL_GetPerformanceCounter() * 1e9 / (double)SDL_GetPerformanceFrequency());
+}
+
+// scancode -> CHIP-8 key, -1 when the key is not mapped. Scancodes are physical positions, so the
+// block stays in place on AZERTY and other layouts
+int8_t scancode_keys[SDL_NUM_SCANCODES];
+
+// return success status of building scancode_keys from a 16 character layout string
+bool set_keymap(const char *layout)
+{
+    if (strlen(layout) != 16)
+    {
+        fprintf(stderr, "Key map needs 16 keys (for 0-F), got \"%s\"\n", layout);
+        return false;
+    }
+    memset(scancode_keys, -1, sizeof(scancode_keys));
+    for (int key = 0; key < 16; key++)
+    {
+        char name[2] = {layout[key], '\0'};
+        SDL_Scancode scancode = SDL_GetScancodeFromName(name);
+        if (scancode == SDL_SCANCODE_UNKNOWN)
+        {
+            fprintf(stderr, "Unknown key '%s' in key map\n", name);
+            return false;
+        }
+        scancode_keys[scancode] = key;
+    }
+    return true;
+}
+
+// returns false once the user closed the app
+bool handle_input(chip8_machine *chip8)
 {
     SDL_Event windowEvent;
     while (SDL_PollEvent (&windowEvent)) {
         switch (windowEvent.type) {
             case SDL_QUIT: // USER CLOSED THE APP
-                exit(EXIT_SUCCESS);
-            // map qwerty keys to CHIP8 keypad
+                return false;
             case SDL_KEYDOWN:
-                switch(windowEvent.key.keysym.sym)
+            case SDL_KEYUP: ;
+                int8_t key = scancode_keys[windowEvent.key.keysym.scancode];
+                if (key < 0)
                 {
-                    case SDLK_1: 
-                        keyboard[0x1] = true;
-                        break;
-                    case SDLK_2: 
-                        keyboard[0x2] = true;
-                        break;
-                    case SDLK_3: 
-                        keyboard[0x3] = true;
-                        break;
-                    case SDLK_4: 
-                        keyboard[0xC] = true;
-                        break;
-                    case SDLK_q: 
-                        keyboard[0x4] = true;
-                        break;
-                    case SDLK_w: 
-                        keyboard[0x5] = true;
-                        break;
-                    case SDLK_e: 
-                        keyboard[0x6] = true;
-                        break;
-                    case SDLK_r: 
-                        keyboard[0xD] = true;
-                        break;
-                    case SDLK_a: 
-                        keyboard[0x7] = true;
-                        break;
-                    case SDLK_s: 
-                        keyboard[0x8] = true;
-                        break;
-                    case SDLK_d: 
-                        keyboard[0x9] = true;
-                        break;
-                    case SDLK_f: 
-                        keyboard[0xE] = true;
-                        break;
-                    case SDLK_z: 
-                        keyboard[0xA] = true;
-                        break;
-                    case SDLK_x: 
-                        keyboard[0x0] = true;
-                        break;
-                    case SDLK_c: 
-                        keyboard[0xB] = true;
-                        break;
-                    case SDLK_v: 
-                        keyboard[0xF] = true;
-                        break;
-                    default:
-                        break;
+                    break;
                 }
-
-            case SDL_KEYUP: // return keys back to false when they are no longer being pressed
-                switch(windowEvent.key.keysym.sym)
+                uint16_t bit = (uint16_t)(1u << key);
+                if (windowEvent.type == SDL_KEYDOWN)
                 {
-                    case SDLK_1: 
-                        keyboard[0x1] = false;
-                        break;
-                    case SDLK_2: 
-                        keyboard[0x2] = false;
-                        break;
-                    case SDLK_3: 
-                        keyboard[0x3] = false;
-                        break;
-                    case SDLK_4: 
-                        keyboard[0xC] = false;
-                        break;
-                    case SDLK_q: 
-                        keyboard[0x4] = false;
-                        break;
-                    case SDLK_w: 
-                        keyboard[0x5] = false;
-                        break;
-                    case SDLK_e: 
-                        keyboard[0x6] = false;
-                        break;
-                    case SDLK_r: 
-                        keyboard[0xD] = false;
-                        break;
-                    case SDLK_a: 
-                        keyboard[0x7] = false;
-                        break;
-                    case SDLK_s: 
-                        keyboard[0x8] = false;
-                        break;
-                    case SDLK_d: 
-                        keyboard[0x9] = false;
-                        break;
-                    case SDLK_f: 
-                        keyboard[0xE] = false;
-                        break;
-                    case SDLK_z: 
-                        keyboard[0xA] = false;
-                        break;
-                    case SDLK_x: 
-                        keyboard[0x0] = false;
-                        break;
-                    case SDLK_c: 
-                        keyboard[0xB] = false;
-                        break;
-                    case SDLK_v: 
-                        keyboard[0xF] = false;
-                        break;
-                    default:
-                        break;
+                    chip8->keys |= bit;
+                    if (!windowEvent.key.repeat)
+                    {
+                        latency.press_time[key] = ticks_ns();
+                        latency.press_frame[key] = latency.frame;
+                        latency.waiting_observe |= bit;
+                        latency.waiting_present &= ~bit;
+                    }
+                }
+                else // return keys back to released when they are no longer being pressed
+                {
+                    chip8->keys &= ~bit;
+                    if (latency.waiting_observe & bit)
+                    {
+                        latency.dropped++;
+                        latency.waiting_observe &= ~bit;
+                    }
                 }
                 break;
             default: break;
         }
     }
+    return true;
 }
 
 void clear_screen(SDL_Renderer *renderer) {
 
-    SDL_SetRenderDrawColor(renderer, BG_COLOUR, BG_COLOUR, BG_COLOUR, SDL_ALPHA_OPAQUE);
+    SDL_SetRenderDrawColor(renderer, PALETTE[0], PALETTE[0], PALETTE[0], SDL_ALPHA_OPAQUE);
     SDL_RenderClear(renderer);
 }
 
-void update_timers(SDL_AudioDeviceID audio) {
-    if (delay_timer > 0) 
-        delay_timer--;
 
-    if (sound_timer > 0) {
-        sound_timer--;
-        SDL_PauseAudioDevice(audio, 0); // Play sound
-    } else {
-        SDL_PauseAudioDevice(audio, 1); // Pause sound
+// runs on SDL's audio thread: play the samples the emulation loop queued
+void audio_callback(void *userdata, uint8_t *stream, int len) {
+    audio_ring_read(userdata, (float *)stream, len / sizeof(float), ticks_ns());
+}
+
+// fill level, underruns and latency of the audio queue. latency is the measured time a frame waits
+// in the ring plus the device buffer it is copied into
+void print_audio_stats(const SDL_AudioSpec *have) {
+    double device_ms = have->samples * 1000.0 / have->freq;
+    fprintf(stderr, "audio: fill %u samples, underruns %u (%u samples), overruns %u samples, "
+            "latency %.1fms (max %.1fms)\n",
+            audio_ring_fill(&ring), atomic_load(&ring.underruns), atomic_load(&ring.underrun_samples),
+            atomic_load(&ring.overrun_samples), atomic_load(&ring.latency_last) / 1e6 + device_ms,
+            atomic_load(&ring.latency_max) / 1e6 + device_ms);
+}
+
+// advance the latency tracker by one presented frame. shown is the machine whose screen was
+// presented at present_time, its keys_observed and display_dirty cover everything since the last frame
+void track_latency(const chip8_machine *shown, uint64_t present_time)
+{
+    uint16_t observed = shown->keys_observed & latency.waiting_observe;
+    for (int key = 0; key < 16; key++)
+    {
+        if (observed & (1u << key))
+        {
+            latency.observe_frames[key] = (uint32_t)(latency.frame - latency.press_frame[key]);
+        }
+    }
+    latency.waiting_observe &= ~observed;
+    latency.waiting_present |= observed;
+
+    if (shown->display_dirty)
+    {
+        for (int key = 0; key < 16; key++)
+        {
+            if (latency.waiting_present & (1u << key))
+            {
+                uint32_t slot = latency.count++ % LATENCY_SAMPLES;
+                latency.latency_ns[slot] = present_time - latency.press_time[key];
+                latency.latency_frames[slot] = latency.observe_frames[key];
+            }
+        }
+        latency.waiting_present = 0;
     }
+    latency.frame++;
 }
 
-void audio_callback(void *userdata, uint8_t *stream, int len) {
-    instruction *some_var = (instruction *) userdata; // userdata isnt needed here but need to use it so there is no error in compilation
-    for (int i=0;i<len;i++) {
-        some_var->N = 1;
-        stream[i] = 1;
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// percentiles of the measured key presses. The time stops at SDL_RenderPresent, the display's own
+// scanout and response time come on top
+void print_latency_stats(void)
+{
+    uint32_t n = latency.count < LATENCY_SAMPLES ? latency.count : LATENCY_SAMPLES;
+    if (n == 0)
+    {
+        fprintf(stderr, "input latency: no key presses were answered by a display change (%u not read by the program)\n",
+                latency.dropped);
+        return;
     }
+    static uint64_t times[LATENCY_SAMPLES];
+    static uint32_t frames[LATENCY_SAMPLES];
+    memcpy(times, latency.latency_ns, n * sizeof(times[0]));
+    memcpy(frames, latency.latency_frames, n * sizeof(frames[0]));
+    qsort(times, n, sizeof(times[0]), compare_u64);
+    qsort(frames, n, sizeof(frames[0]), compare_u32);
+    fprintf(stderr, "input latency over %u presses: p50 %.1fms, p90 %.1fms, p99 %.1fms, max %.1fms; "
+            "read by the program after p50 %u, p90 %u frames; %u presses not read\n",
+            n, times[n / 2] / 1e6, times[n * 9 / 10] / 1e6, times[n * 99 / 100] / 1e6, times[n - 1] / 1e6,
+            frames[n / 2], frames[n * 9 / 10], latency.dropped);
 }
 
 int main(int argc, char **argv) {
     if(argc < 2)
     {
-        fprintf(stderr, "Error encountered\n");
+        fprintf(stderr, "usage: %s ROM [--audio-stats] [--pacing audio|timer] [--keymap KEYS] [--seed N] [--profile NAME] [--romdb DB] [--record MOVIE | --play MOVIE] [--run-ahead N] [--latency-stats]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    bool audio_stats = false; // print audio queue telemetry once a second
+    bool latency_stats = false; // print input-to-photon latency percentiles on exit
+    bool audio_pacing = true; // let the audio device clock decide when the next frame runs
+    const char *keymap = NULL; // NULL: the ROM database's layout for this ROM, or DEFAULT_KEYMAP
+    uint32_t seed = DEFAULT_SEED;
+    quirk_profile profile = PROFILE_CHIP8; // quirks of the interpreter the ROM was written for
+    bool profile_set = false;
+    const char *romdb_path = NULL; // NULL: DEFAULT_ROMDB if there is one
+    const char *record_path = NULL; // write the input of every frame to a movie
+    const char *play_path = NULL; // take the input from a movie instead of the keyboard
+    unsigned int run_ahead = 0; // frames emulated past the real machine for display only
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--audio-stats") == 0)
+            audio_stats = true;
+        else if (strcmp(argv[i], "--latency-stats") == 0)
+            latency_stats = true;
+        else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc)
+            audio_pacing = strcmp(argv[++i], "timer") != 0;
+        else if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc)
+            keymap = argv[++i];
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            if (!parse_profile(argv[++i], &profile))
+            {
+                fprintf(stderr, "Unknown profile %s (chip8, schip or xochip)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            profile_set = true;
+        }
+        else if (strcmp(argv[i], "--romdb") == 0 && i + 1 < argc)
+            romdb_path = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_path = argv[++i];
+        else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+            play_path = argv[++i];
+        else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+            run_ahead = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (run_ahead > MAX_RUN_AHEAD)
+    {
+        fprintf(stderr, "--run-ahead is limited to %d frames\n", MAX_RUN_AHEAD);
         exit(EXIT_FAILURE);
     }
     // Initialize SDL
@@ -534,10 +330,62 @@ int main(int argc, char **argv) {
     }
 
     // Initialize CHIP-8 Machine
-    if(!init_chip8(argv[1]))
+    static chip8_machine chip8; // static, the machine is a few kilobytes
+    if(!init_chip8(&chip8, argv[1]))
     {
         return 1;
     }
+    seed_chip8(&chip8, seed);
+
+    // start a known ROM with the settings from the ROM database, options given on the command line win
+    unsigned int instructions_per_frame = INSTRUCTIONS_PER_FRAME;
+    static rom_info info; // keeps the keymap string alive
+    romdb db;
+    if (open_romdb(&db, romdb_path ? romdb_path : DEFAULT_ROMDB))
+    {
+        if (find_rom(&db, chip8.rom_hash, &info))
+        {
+            printf("%s: %s (%s, %u instructions per frame)\n", argv[1], info.title, profile_name(info.profile),
+                   info.instructions_per_frame);
+            profile = profile_set ? profile : (quirk_profile)info.profile;
+            instructions_per_frame = info.instructions_per_frame;
+            keymap = keymap || !info.keymap[0] ? keymap : info.keymap;
+        }
+        close_romdb(&db);
+    }
+    else if (romdb_path)
+    {
+        fprintf(stderr, "Could not open ROM database %s\n", romdb_path);
+        return 1;
+    }
+    chip8.profile = profile;
+    if(!set_keymap(keymap ? keymap : DEFAULT_KEYMAP)){
+        return 1;
+    }
+
+    static movie mv;
+    if (record_path && play_path)
+    {
+        fprintf(stderr, "--record and --play can't be used together\n");
+        return 1;
+    }
+    if (record_path)
+    {
+        movie_header header = {.rom_hash = chip8.rom_hash, .seed = seed, .frame_rate = MOVIE_FRAME_RATE,
+                               .instructions_per_frame = instructions_per_frame, .profile = profile};
+        if (!create_movie(&mv, record_path, &header))
+        {
+            return 1;
+        }
+    }
+    if (play_path)
+    {
+        if (!open_movie(&mv, play_path) || !start_movie(&mv, &chip8))
+        {
+            return 1;
+        }
+        instructions_per_frame = mv.header.instructions_per_frame;
+    }
 
     // Create the window
     SDL_Window *window = create_window();
@@ -546,42 +394,156 @@ int main(int argc, char **argv) {
 
     SDL_AudioSpec want, have;
     SDL_AudioDeviceID dev;
+    static square_wave wave;
+    init_square_wave(&wave, BEEP_FREQUENCY, AUDIO_SAMPLE_RATE, BEEP_VOLUME);
 
     SDL_memset(&want, 0, sizeof(want)); /* or SDL_zero(want) */
-    want.freq = 48000;
-    want.format = AUDIO_F32;
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_F32; // no format change allowed, SDL converts if the device wants something else
     want.channels = 1; // only need 1 sound channel for CHIP-8
-    want.samples = 4096;
-    want.callback = audio_callback;  // you wrote this function elsewhere.
-    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+    want.samples = AUDIO_BUFFER_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = &ring;
+    init_audio_ring(&ring);
+    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (dev == 0 || have.freq > 192000)
+    {
+        SDL_Log("Could not open audio device, continuing without sound: %s\n", SDL_GetError());
+        if (dev != 0)
+            SDL_CloseAudioDevice(dev);
+        dev = 0;
+        have = want;
+    }
+    else
+    {
+        init_square_wave(&wave, BEEP_FREQUENCY, have.freq, BEEP_VOLUME);
+        SDL_PauseAudioDevice(dev, 0); // start once, silence is queued while the beeper is off
+    }
+    static float frame_samples[MAX_FRAME_SAMPLES];
+    uint64_t frame = 0;
+
+    // With audio pacing a frame is emulated whenever the queue drops below one device buffer plus one
+    // frame, i.e. exactly as fast as the device consumes samples. The 60Hz timers then run on the same
+    // clock as the 48kHz output, so there is no slow drift into underruns (crackles) or a growing queue.
+    audio_pacing = audio_pacing && dev != 0; // nothing to pace against without a device, use the timer
+    uint32_t pacing_target = have.samples + have.freq / 60;
 
     // Set initial Screen Colour
-    SDL_SetRenderDrawColor(renderer, BG_COLOUR, BG_COLOUR, BG_COLOUR, SDL_ALPHA_OPAQUE);
+    SDL_SetRenderDrawColor(renderer, PALETTE[0], PALETTE[0], PALETTE[0], SDL_ALPHA_OPAQUE);
     SDL_RenderClear(renderer);
 
     instruction instr;
-    // Main Loop
+    // Main Loop, one iteration per 60Hz frame
     while (true) {
+        if (audio_pacing)
+        {
+            while (audio_ring_fill(&ring) >= pacing_target)
+            {
+                SDL_Delay(1);
+            }
+        }
+
         // handle user input
-        handle_input();
+        if (!handle_input(&chip8))
+        {
+            break;
+        }
+        if (record_path)
+        {
+            record_movie_frame(&mv, chip8.keys);
+        }
+        if (play_path && !play_movie_frame(&mv, &chip8.keys))
+        {
+            printf("Movie finished after %u frames, keyboard input is live again\n", mv.frame);
+            if (!close_movie(&mv))
+            {
+                fprintf(stderr, "Movie %s is truncated or unreadable\n", play_path);
+            }
+            play_path = NULL;
+        }
         uint64_t start_time = SDL_GetPerformanceCounter();
-        execute_instruction(&instr); // fetch, decode, and execute instruction from RAM
-        uint64_t end_time = SDL_GetPerformanceCounter();
 
-        uint64_t instr_time = ((end_time - start_time) * 1000) / SDL_GetPerformanceFrequency();
+        // fetch, decode, and execute a frame of instructions, rendering the beeper samples that belong
+        // to it (exact over time even when the device rate is not a multiple of 60)
+        int sample_count = (int)(((frame + 1) * have.freq) / 60 - (frame * have.freq) / 60);
+        run_frame_audio(&chip8, &instr, instructions_per_frame, &wave, frame_samples, sample_count);
+        if (dev != 0)
+        {
+            audio_ring_write(&ring, frame_samples, sample_count, ticks_ns());
+        }
 
-        // Delay by roughly 60 FPS
-        SDL_Delay(16.67 > instr_time ? 16.67 - instr_time : 0); // 1/16ms = 60Hz = 60FPS (technically should be 16.6666... but only accept ints)
+        // Run-ahead: many games only show the effect of a key press a frame or two after reading it.
+        // Emulate run_ahead more frames with the current input on a copy of the machine and show
+        // that instead. The real machine (timers, sound, movie input) is never touched, so dropping
+        // the copy is the restore. The copy and up to a few frames are a few microseconds.
+        const chip8_machine *shown = &chip8;
+        if (run_ahead > 0)
+        {
+            static chip8_machine ahead;
+            instruction ahead_instr;
+            ahead = chip8;
+            for (unsigned int i = 0; i < run_ahead; i++)
+            {
+                run_frame(&ahead, &ahead_instr, instructions_per_frame);
+            }
+            shown = &ahead;
+        }
 
         // Update window with changes
-        update_screen(renderer);  
-        update_timers(dev);
+        update_screen(renderer, shown);
+        track_latency(shown, ticks_ns());
+        chip8.keys_observed = 0;
+        chip8.display_dirty = false;
+        if (chip8.halted) // the program ended with 00FD, or faulted
+        {
+            if (chip8.fault != FAULT_NONE)
+            {
+                fprintf(stderr, "%s stopped at %04X: %s\n", argv[1], chip8.fault_address, fault_name(chip8.fault));
+            }
+            break;
+        }
+        frame++;
+        if (audio_stats && frame % 60 == 0)
+        {
+            print_audio_stats(&have);
+        }
 
+        if (!audio_pacing)
+        {
+            uint64_t end_time = SDL_GetPerformanceCounter();
+            uint64_t frame_time = ((end_time - start_time) * 1000) / SDL_GetPerformanceFrequency();
+
+            // Delay by roughly 60 FPS
+            SDL_Delay(16.67 > frame_time ? 16.67 - frame_time : 0); // 1/16ms = 60Hz = 60FPS (technically should be 16.6666... but only accept ints)
+        }
     }
 
     // Cleanup in the end
-    SDL_DestroyWindow (window);
+    if (latency_stats)
+    {
+        print_latency_stats();
+    }
+    if (record_path)
+    {
+        if (!close_movie(&mv))
+        {
+            fprintf(stderr, "Could not write %s\n", record_path);
+        }
+        else
+        {
+            printf("Recorded %u frames to %s\n", mv.frame, record_path);
+        }
+    }
+    if (play_path)
+    {
+        close_movie(&mv);
+    }
+    if (dev != 0)
+    {
+        SDL_CloseAudioDevice(dev);
+    }
     SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,131 @@
+// libchip8: the CHIP-8 CPU core, shared by the SDL frontend (chip8.c), the headless frontend
+// (chip8_headless.c) and the tools. Implemented in chip8_core.c.
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DISPLAY_WIDTH 64 // CHIP-8 (lo-res) display
+#define DISPLAY_HEIGHT 32
+#define HIRES_WIDTH 128 // SUPER-CHIP hi-res display
+#define HIRES_HEIGHT 64
+#define BIG_FONT_LOCATION 0x50 // SUPER-CHIP 8x10 digits (FX30), right after the 4x5 ones
+#define DISPLAY_PLANES 2 // XO-CHIP draws on two bitplanes, a pixel has one of 4 colours
+#define AUDIO_PATTERN_BYTES 16 // XO-CHIP audio pattern: 128 1-bit samples
+#define DEFAULT_PITCH 64 // XO-CHIP FX3A value for a 4000Hz pattern playback rate
+#define RAM_SIZE 0x10000 // 64kb address space (XO-CHIP), CHIP-8 and SUPER-CHIP programs only use the first 4kb
+#define RAM_GUARD 64 // the most bytes an instruction touches from I: a 16 x 16 sprite on both XO-CHIP planes
+#define RAM_PAGE_SIZE 0x1000 // granularity of ram_pages_written, RAM and the guard are 17 pages
+#define STACK_LEVELS 12 // 2NNN nesting before a stack overflow
+#define STACK_SLOTS 16 // stack entries, a power of two so the stack pointer can be masked
+#define BEGIN_LOCATION 512 // original CHIP-8 occupies first 512 bytes, so most programs start at memory location 512, this convention will be followed here
+#define INSTRUCTIONS_PER_FRAME 10 // default emulation speed for headless runs: 600 instructions per second
+#define DEFAULT_SEED 1 // CXNN random sequence of a freshly reset machine
+
+// Quirk profiles: the interpreters a ROM may have been written for disagree on a few instructions
+// (see chip8_interpreter.h). Every profile runs every opcode, CHIP-8, SUPER-CHIP and XO-CHIP ones.
+typedef enum {
+    PROFILE_CHIP8, // COSMAC VIP: VF reset, I incremented by FX55/FX65, shifts use VY, sprites clipped, DXYN waits for vblank
+    PROFILE_SCHIP, // SUPER-CHIP 1.1: shifts use VX, BXNN, I unchanged by FX55/FX65, sprites clipped
+    PROFILE_XOCHIP, // XO-CHIP: like the VIP without VF reset or vblank wait, sprites wrap around the edges
+    PROFILE_COUNT
+} quirk_profile;
+
+// What a machine did that a correct program never does. Memory safety doesn't depend on it: every
+// access is inside the machine by construction (RAM_GUARD, STACK_SLOTS), faults are only recorded
+// so untrusted ROMs can be told apart from working ones.
+typedef enum {
+    FAULT_NONE,
+    FAULT_STACK_OVERFLOW, // 2NNN with all 12 stack levels in use
+    FAULT_STACK_UNDERFLOW, // 00EE with an empty stack
+    FAULT_MEMORY, // an access from I (DXYN, FX33, FX55, FX65, 5XY2, 5XY3, F002) past the end of RAM
+    FAULT_COUNT
+} chip8_fault;
+
+// CHIP-8 SPECIFICATIONS
+// The whole machine is plain data without pointers (RNG included), so a struct copy is a complete
+// snapshot: restoring it and feeding the same input reproduces the same frames.
+typedef struct {
+    // RAM_SIZE bytes of RAM then the guard, which accesses from I near the end of RAM run into
+    // instead of past the machine. Addresses are 16 bits, so nothing reaches beyond the guard.
+    uint8_t ram[RAM_SIZE + RAM_GUARD];
+    // Framebuffer, one bitplane per XO-CHIP plane, one bit per pixel. Row y of a plane is
+    // display[plane][y][0] (x 0-63, most significant bit first) followed by display[plane][y][1]
+    // (x 64-127). The 64 x 32 CHIP-8 screen is the top left corner, so a lo-res row is exactly one
+    // word. Sprites are drawn with shifts and a whole row at a time, scrolling is a word shift or a
+    // memmove of rows. CHIP-8 and SUPER-CHIP programs only draw on plane 0.
+    uint64_t display[DISPLAY_PLANES][HIRES_HEIGHT][2];
+    uint8_t planes; // XO-CHIP FN01 plane mask, bit P selects plane P for drawing, clearing and scrolling
+    bool hires; // SUPER-CHIP 128 x 64 mode (00FF), 00FE switches back to 64 x 32
+    bool halted; // SUPER-CHIP 00FD (exit interpreter) was executed, it stays on it, or the machine faulted
+    uint8_t fault; // first chip8_fault of the run, the machine runs on safely but frontends stop on halted
+    uint16_t fault_address; // address of the instruction that faulted
+    uint8_t rpl_flags[16]; // SUPER-CHIP FX75/FX85 storage, the HP-48 RPL user flags
+    uint8_t audio_pattern[AUDIO_PATTERN_BYTES]; // XO-CHIP F002 sample pattern, played most significant bit first
+    uint8_t pitch; // XO-CHIP FX3A, the pattern plays at 4000 * 2^((pitch - 64) / 48) samples per second
+    bool audio_pattern_set; // F002 has run, the beeper plays the pattern instead of its fixed tone
+    uint16_t keys; // CHIP-8 Keyboard is a hex keyboard, bit K is set while key K is held
+    uint16_t keys_latched; // keys seen held while FX0A waits, it completes when one of them is released
+    uint16_t keys_observed; // keys the program found held (EX9E/EXA1) or got from FX0A, frontends clear it
+    bool display_dirty; // set by every instruction that changes the display, frontends clear it once presented
+    bool ram_dirty; // set by every instruction that writes RAM (FX33, FX55, 5XY2), cleared by whoever watches it
+    bool keys_polled; // EX9E, EXA1 or FX0A ran, the program looked at the keypad, cleared like ram_dirty
+    uint32_t ram_pages_written; // bit P is set once an instruction wrote to RAM page P (RAM_PAGE_SIZE), only reset clears it
+    uint16_t stack[STACK_SLOTS]; // The original RCA 1802 version allocated 48 bytes for up to 12 levels of nesting
+    uint8_t cur_stack; // points to the current stack, always below STACK_SLOTS
+    uint8_t data_registers[16]; // CHIP-8 has 16 8-bit data registers V0-VF
+    uint16_t I; // 12-bit address register used with several opcodes that involve memory operations
+    uint16_t PC; // store memory address of instruction to be executed next
+
+    // BOTH TIMERS COUNT DOWN at 60Hz, UNTIL THEY REACH 0
+    uint8_t delay_timer; // used for timing the events of game. can be set and read
+    uint8_t sound_timer; // used for sound effects, a beeping sound is made when this is not zero
+
+    uint32_t rng; // CXNN random number generator state (xorshift32), part of the machine so runs replay exactly
+    uint64_t rom_hash; // FNV-1a of the loaded ROM, identifies it in movie files
+    uint8_t profile; // quirk_profile the machine runs with, reset to PROFILE_CHIP8, set it after loading the ROM
+    bool vblank; // a timer tick happened since the last draw, what PROFILE_CHIP8 DXYN waits for
+} chip8_machine;
+
+typedef struct {
+    uint16_t opcode;
+    uint16_t NNN; // 12-bit address
+    uint8_t NN;  // 8-bit constant
+    uint8_t N;  // 4-bit constant
+    uint8_t X; // 4-bit register identifier
+    uint8_t Y;// 4-bit register identifier
+} instruction;
+
+// size and contents of the screen in the current mode
+static inline unsigned int display_width(const chip8_machine *chip8)
+{
+    return chip8->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+}
+
+static inline unsigned int display_height(const chip8_machine *chip8)
+{
+    return chip8->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+}
+
+// colour 0-3 of a pixel: bit P is the pixel in plane P
+static inline unsigned int display_pixel(const chip8_machine *chip8, unsigned int x, unsigned int y)
+{
+    unsigned int shift = 63 - (x & 63);
+    return ((chip8->display[0][y][x >> 6] >> shift) & 1) | ((chip8->display[1][y][x >> 6] >> shift) & 1) << 1;
+}
+
+void reset_chip8(chip8_machine *chip8);
+bool load_rom(chip8_machine *chip8, const uint8_t *rom_data, size_t rom_size);
+bool init_chip8(chip8_machine *chip8, const char *rom_file);
+void seed_chip8(chip8_machine *chip8, uint32_t seed);
+void execute_instruction(chip8_machine *chip8, instruction *instr);
+bool parse_profile(const char *name, quirk_profile *profile);
+const char *profile_name(quirk_profile profile);
+const char *fault_name(chip8_fault fault);
+void tick_timers(chip8_machine *chip8);
+void run_frame(chip8_machine *chip8, instruction *instr, unsigned int instructions);
+unsigned int run_until_sound(chip8_machine *chip8, instruction *instr, unsigned int instructions);
+
+#endif // CHIP8_H
@@ -0,0 +1,125 @@
+// ROM archives, see chip8_archive.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_archive.h"
+#include "chip8_mmap.h"
+
+static uint64_t get_le(const uint8_t *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// return whether index entry i points inside the file, at a ROM that fits in RAM and a terminated name
+static bool check_entry(const rom_archive *archive, uint32_t i)
+{
+    const uint8_t *entry = &archive->index[(size_t)i * ARCHIVE_ENTRY_SIZE];
+    uint64_t offset = get_le(&entry[8], 8);
+    uint64_t size = get_le(&entry[16], 4);
+    uint64_t name = get_le(&entry[20], 4);
+    size_t file_size = archive->file.size;
+    if (offset > file_size || size > file_size - offset || size > RAM_SIZE - BEGIN_LOCATION
+        || name >= file_size)
+    {
+        return false;
+    }
+    return memchr(&archive->file.data[name], '\0', file_size - name) != NULL;
+}
+
+// return success status of mapping an archive written by tools/pack.c. The whole index is checked
+// here, so the lookups below can trust it
+bool open_archive(rom_archive *archive, const char *path)
+{
+    archive->index = NULL;
+    archive->count = 0;
+    if (!map_file(&archive->file, path))
+    {
+        fprintf(stderr, "Could not find file %s\n", path);
+        return false;
+    }
+    const uint8_t *data = archive->file.data;
+    size_t size = archive->file.size;
+    if (size < ARCHIVE_HEADER_SIZE || memcmp(data, ARCHIVE_MAGIC, 4) != 0 || get_le(&data[4], 4) != ARCHIVE_VERSION
+        || get_le(&data[8], 4) > (size - ARCHIVE_HEADER_SIZE) / ARCHIVE_ENTRY_SIZE)
+    {
+        fprintf(stderr, "%s is not a version %d ROM archive\n", path, ARCHIVE_VERSION);
+        unmap_file(&archive->file);
+        return false;
+    }
+    archive->index = &data[ARCHIVE_HEADER_SIZE];
+    archive->count = (uint32_t)get_le(&data[8], 4);
+    for (uint32_t i = 0; i < archive->count; i++)
+    {
+        if (!check_entry(archive, i))
+        {
+            fprintf(stderr, "%s is corrupt (entry %u)\n", path, i);
+            close_archive(archive);
+            return false;
+        }
+    }
+    return true;
+}
+
+// the i-th ROM in hash order, i < archive->count
+void get_archive_rom(const rom_archive *archive, uint32_t i, archive_rom *rom)
+{
+    const uint8_t *entry = &archive->index[(size_t)i * ARCHIVE_ENTRY_SIZE];
+    rom->rom_hash = get_le(entry, 8);
+    rom->data = &archive->file.data[get_le(&entry[8], 8)];
+    rom->size = (uint32_t)get_le(&entry[16], 4);
+    rom->name = (const char *)&archive->file.data[get_le(&entry[20], 4)];
+}
+
+// return whether the archive holds the ROM with this hash, binary search of the index
+bool find_archive_rom(const rom_archive *archive, uint64_t rom_hash, archive_rom *rom)
+{
+    uint32_t low = 0, high = archive->count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        uint64_t hash = get_le(&archive->index[(size_t)middle * ARCHIVE_ENTRY_SIZE], 8);
+        if (hash < rom_hash)
+        {
+            low = middle + 1;
+        }
+        else if (hash > rom_hash)
+        {
+            high = middle;
+        }
+        else
+        {
+            get_archive_rom(archive, middle, rom);
+            return true;
+        }
+    }
+    return false;
+}
+
+// return whether the archive holds a ROM packed from a file with this name, a linear scan
+bool find_archive_name(const rom_archive *archive, const char *name, archive_rom *rom)
+{
+    for (uint32_t i = 0; i < archive->count; i++)
+    {
+        get_archive_rom(archive, i, rom);
+        if (strcmp(rom->name, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void close_archive(rom_archive *archive)
+{
+    unmap_file(&archive->file);
+    archive->index = NULL;
+    archive->count = 0;
+}
@@ -0,0 +1,41 @@
+// ROM archives: many ROMs packed into one file with an index by content hash, part of libchip8.
+// The archive is memory mapped once and every ROM is copied from the mapping straight into a
+// machine's RAM, so a batch over thousands of ROMs opens one file instead of thousands.
+#ifndef CHIP8_ARCHIVE_H
+#define CHIP8_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "chip8_mmap.h"
+
+#define ARCHIVE_MAGIC "C8RA"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 16
+#define ARCHIVE_ENTRY_SIZE 24
+
+// File layout, little endian: "C8RA", u32 version, u32 count, u32 reserved, then count 24 byte
+// index entries sorted by hash: u64 ROM hash (chip8_machine.rom_hash), u64 offset of the ROM data,
+// u32 ROM size, u32 offset of its name (zero terminated). Names and ROM data follow the index.
+// Every ROM is stored once, tools/pack.c drops duplicates.
+typedef struct {
+    mapped_file file;
+    const uint8_t *index;
+    uint32_t count;
+} rom_archive;
+
+typedef struct {
+    uint64_t rom_hash;
+    const uint8_t *data; // points into the mapping, valid until close_archive()
+    uint32_t size;
+    const char *name; // file name the ROM was packed from
+} archive_rom;
+
+bool open_archive(rom_archive *archive, const char *path);
+void get_archive_rom(const rom_archive *archive, uint32_t i, archive_rom *rom);
+bool find_archive_rom(const rom_archive *archive, uint64_t rom_hash, archive_rom *rom);
+bool find_archive_name(const rom_archive *archive, const char *name, archive_rom *rom);
+void close_archive(rom_archive *archive);
+
+#endif // CHIP8_ARCHIVE_H
@@ -0,0 +1,275 @@
+// Beeper sound generation, see chip8_audio.h
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_audio.h"
+
+void init_square_wave(square_wave *wave, int frequency, int sample_rate, float volume)
+{
+    wave->phase = 0.0;
+    wave->increment = (double)frequency / sample_rate;
+    wave->volume = volume;
+    wave->level = 0.0f;
+    wave->ramp = 1000.0f / sample_rate; // 1ms from silent to full volume
+    wave->sample_rate = sample_rate;
+    wave->pattern_position = 0.0;
+}
+
+// move the gate level one sample towards on or off
+static float gate_level(square_wave *wave, bool on)
+{
+    float target = on ? 1.0f : 0.0f;
+    if (wave->level < target)
+    {
+        wave->level = wave->level + wave->ramp > target ? target : wave->level + wave->ramp;
+    }
+    else if (wave->level > target)
+    {
+        wave->level = wave->level - wave->ramp < target ? target : wave->level - wave->ramp;
+    }
+    return wave->level;
+}
+
+// polyBLEP residual: smooths the discontinuity of a hard edge over one sample on each side of it
+static double poly_blep(double t, double dt)
+{
+    if (t < dt)
+    {
+        t /= dt;
+        return t + t - t * t - 1.0;
+    }
+    if (t > 1.0 - dt)
+    {
+        t = (t - 1.0) / dt;
+        return t * t + t + t + 1.0;
+    }
+    return 0.0;
+}
+
+// write count mono float samples, the tone is audible while on is true
+void render_square_wave(square_wave *wave, float *out, int count, bool on)
+{
+    if (!on && wave->level == 0.0f) // silent, which is most of the time: skip the oscillator
+    {
+        memset(out, 0, count * sizeof(float));
+        wave->phase += wave->increment * count;
+        wave->phase -= (long)wave->phase;
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        double t = wave->phase;
+        double half = t + 0.5 >= 1.0 ? t - 0.5 : t + 0.5;
+        double sample = t < 0.5 ? 1.0 : -1.0;
+        sample += poly_blep(t, wave->increment); // rising edge at t = 0
+        sample -= poly_blep(half, wave->increment); // falling edge at t = 0.5
+
+        out[i] = (float)sample * wave->volume * gate_level(wave, on);
+
+        wave->phase += wave->increment;
+        if (wave->phase >= 1.0)
+        {
+            wave->phase -= 1.0;
+        }
+    }
+}
+
+// XO-CHIP pattern playback rate in samples per second: 4000 * 2^((pitch - 64) / 48). Done with
+// whole octaves and 1/48 octave steps so libchip8 does not need libm
+static double pattern_rate(uint8_t pitch)
+{
+    int steps = pitch - DEFAULT_PITCH;
+    double rate = 4000.0;
+    for (; steps >= 48; steps -= 48)
+    {
+        rate *= 2.0;
+    }
+    for (; steps < 0; steps += 48)
+    {
+        rate *= 0.5;
+    }
+    for (; steps > 0; steps--)
+    {
+        rate *= 1.0145453349375237; // 2^(1/48)
+    }
+    return rate;
+}
+
+// write count samples of the XO-CHIP audio pattern, looped, audible while on is true. The pattern's
+// own 1-bit samples are held (nearest neighbour), which is what XO-CHIP programs are written for
+void render_audio_pattern(square_wave *wave, const uint8_t *pattern, uint8_t pitch, float *out, int count, bool on)
+{
+    double increment = pattern_rate(pitch) / wave->sample_rate;
+    if (!on && wave->level == 0.0f) // silent, just keep the position moving
+    {
+        memset(out, 0, count * sizeof(float));
+        wave->pattern_position += increment * count;
+        wave->pattern_position -= (long)(wave->pattern_position / (AUDIO_PATTERN_BYTES * 8)) * (AUDIO_PATTERN_BYTES * 8);
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int bit = (unsigned int)wave->pattern_position;
+        float sample = (pattern[bit >> 3] >> (7 - (bit & 7))) & 1 ? 1.0f : -1.0f;
+        out[i] = sample * wave->volume * gate_level(wave, on);
+
+        wave->pattern_position += increment;
+        while (wave->pattern_position >= AUDIO_PATTERN_BYTES * 8)
+        {
+            wave->pattern_position -= AUDIO_PATTERN_BYTES * 8;
+        }
+    }
+}
+
+void init_audio_ring(audio_ring *ring)
+{
+    atomic_store(&ring->write_pos, 0);
+    atomic_store(&ring->read_pos, 0);
+    atomic_store(&ring->markers_written, 0);
+    ring->markers_read = 0;
+    atomic_store(&ring->underruns, 0);
+    atomic_store(&ring->underrun_samples, 0);
+    atomic_store(&ring->overrun_samples, 0);
+    atomic_store(&ring->latency_last, 0);
+    atomic_store(&ring->latency_max, 0);
+}
+
+// number of samples queued and not yet played
+uint32_t audio_ring_fill(audio_ring *ring)
+{
+    return atomic_load_explicit(&ring->write_pos, memory_order_acquire) -
+           atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+}
+
+// producer side: queue one frame of samples, returns how many fit. now is the caller's clock
+uint32_t audio_ring_write(audio_ring *ring, const float *samples, uint32_t count, uint64_t now)
+{
+    uint32_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    uint32_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    uint32_t space = AUDIO_RING_SAMPLES - (write_pos - read_pos);
+    uint32_t written = count < space ? count : space;
+
+    for (uint32_t i = 0; i < written; i++)
+    {
+        ring->samples[(write_pos + i) & (AUDIO_RING_SAMPLES - 1)] = samples[i];
+    }
+    if (written < count)
+    {
+        atomic_fetch_add_explicit(&ring->overrun_samples, count - written, memory_order_relaxed);
+    }
+
+    uint32_t marker = atomic_load_explicit(&ring->markers_written, memory_order_relaxed);
+    ring->marker_position[marker & (AUDIO_RING_MARKERS - 1)] = write_pos;
+    ring->marker_time[marker & (AUDIO_RING_MARKERS - 1)] = now;
+    atomic_store_explicit(&ring->markers_written, marker + 1, memory_order_release);
+
+    atomic_store_explicit(&ring->write_pos, write_pos + written, memory_order_release);
+    return written;
+}
+
+// consumer side: fill out with count samples, padding with silence when the ring runs dry
+void audio_ring_read(audio_ring *ring, float *out, uint32_t count, uint64_t now)
+{
+    uint32_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    uint32_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    uint32_t available = write_pos - read_pos;
+    uint32_t taken = count < available ? count : available;
+
+    for (uint32_t i = 0; i < taken; i++)
+    {
+        out[i] = ring->samples[(read_pos + i) & (AUDIO_RING_SAMPLES - 1)];
+    }
+    for (uint32_t i = taken; i < count; i++)
+    {
+        out[i] = 0.0f;
+    }
+    if (taken < count)
+    {
+        atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ring->underrun_samples, count - taken, memory_order_relaxed);
+    }
+
+    // every frame whose first sample is being played now has reached the device
+    uint32_t markers = atomic_load_explicit(&ring->markers_written, memory_order_acquire);
+    if (markers - ring->markers_read > AUDIO_RING_MARKERS) // fell behind, the oldest ones were overwritten
+    {
+        ring->markers_read = markers - AUDIO_RING_MARKERS;
+    }
+    while (ring->markers_read != markers)
+    {
+        uint32_t slot = ring->markers_read & (AUDIO_RING_MARKERS - 1);
+        if ((int32_t)(ring->marker_position[slot] - read_pos) >= (int32_t)taken)
+        {
+            break;
+        }
+        uint64_t latency = now - ring->marker_time[slot];
+        atomic_store_explicit(&ring->latency_last, latency, memory_order_relaxed);
+        if (latency > atomic_load_explicit(&ring->latency_max, memory_order_relaxed))
+        {
+            atomic_store_explicit(&ring->latency_max, latency, memory_order_relaxed);
+        }
+        ring->markers_read++;
+    }
+
+    atomic_store_explicit(&ring->read_pos, read_pos + taken, memory_order_release);
+}
+
+// what the beeper plays, captured before instructions that may change it
+typedef struct {
+    bool on;
+    bool pattern_set;
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_BYTES];
+} beeper_state;
+
+static void capture_beeper(beeper_state *beeper, const chip8_machine *chip8)
+{
+    beeper->on = chip8->sound_timer > 0;
+    beeper->pattern_set = chip8->audio_pattern_set;
+    beeper->pitch = chip8->pitch;
+    memcpy(beeper->pattern, chip8->audio_pattern, sizeof(beeper->pattern));
+}
+
+static void render_beeper(square_wave *wave, const beeper_state *beeper, float *out, int count)
+{
+    if (beeper->pattern_set)
+    {
+        render_audio_pattern(wave, beeper->pattern, beeper->pitch, out, count, beeper->on);
+    }
+    else
+    {
+        render_square_wave(wave, out, count, beeper->on);
+    }
+}
+
+// The samples after instruction i are those up to count * (i + 1) / instructions, played with the
+// beeper as instruction i left it. Instructions run in stretches through the specialised
+// interpreter (run_until_sound()), only the last of which can change the sound: everything before
+// it is rendered with the sound the stretch started with.
+void run_frame_audio(chip8_machine *chip8, instruction *instr, unsigned int instructions,
+                     square_wave *wave, float *out, int count)
+{
+    beeper_state beeper;
+    capture_beeper(&beeper, chip8);
+    if (instructions == 0)
+    {
+        render_beeper(wave, &beeper, out, count);
+    }
+    int rendered = 0;
+    unsigned int done = 0;
+    while (done < instructions)
+    {
+        done += run_until_sound(chip8, instr, instructions - done);
+        int before_last = (int)(((long)count * (done - 1)) / instructions);
+        render_beeper(wave, &beeper, out + rendered, before_last - rendered);
+        capture_beeper(&beeper, chip8);
+        int end = (int)(((long)count * done) / instructions);
+        render_beeper(wave, &beeper, out + before_last, end - before_last);
+        rendered = end;
+    }
+    tick_timers(chip8);
+}
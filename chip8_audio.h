@@ -0,0 +1,66 @@
+// Beeper sound generation for the CHIP-8 sound timer, part of libchip8 (no SDL dependency).
+#ifndef CHIP8_AUDIO_H
+#define CHIP8_AUDIO_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define AUDIO_SAMPLE_RATE 48000
+#define BEEP_FREQUENCY 440 // Hz, the original hardware had a fixed tone too
+#define BEEP_VOLUME 0.25f
+#define AUDIO_RING_SAMPLES 8192 // ring capacity, power of two (~170ms at 48kHz)
+#define AUDIO_RING_MARKERS 64 // frame start timestamps kept for latency measurement, power of two
+
+// Square wave oscillator driven by a phase accumulator. Edges are band limited (polyBLEP) so the
+// tone does not alias, and the output fades in and out over about a millisecond when the beeper
+// is switched, so gating it at any sample does not click.
+typedef struct {
+    double phase; // position within the current period, 0 <= phase < 1
+    double increment; // phase advance per sample: frequency / sample rate
+    float volume;
+    float level; // current gate level, moves towards 0 or 1
+    float ramp; // gate level change per sample
+    int sample_rate;
+    double pattern_position; // XO-CHIP: playback position in the 128 sample audio pattern
+} square_wave;
+
+void init_square_wave(square_wave *wave, int frequency, int sample_rate, float volume);
+void render_square_wave(square_wave *wave, float *out, int count, bool on);
+void render_audio_pattern(square_wave *wave, const uint8_t *pattern, uint8_t pitch, float *out, int count, bool on);
+
+// Lock-free single producer / single consumer sample ring. The emulation thread writes the samples
+// of every frame, the audio device callback reads them. Positions are free running sample counters,
+// so fill level = write_pos - read_pos. Each frame also leaves a marker (its first sample position
+// and the time it was written), which the reader turns into a queue latency once it plays that sample.
+typedef struct {
+    float samples[AUDIO_RING_SAMPLES];
+    uint32_t marker_position[AUDIO_RING_MARKERS];
+    uint64_t marker_time[AUDIO_RING_MARKERS];
+    _Atomic uint32_t write_pos; // written by the producer only
+    _Atomic uint32_t read_pos; // written by the consumer only
+    _Atomic uint32_t markers_written; // producer
+    uint32_t markers_read; // consumer private
+
+    // telemetry, written by one side and safe to read from the other
+    _Atomic uint32_t underruns; // reads that found fewer samples than the device asked for
+    _Atomic uint32_t underrun_samples; // silence inserted because of underruns
+    _Atomic uint32_t overrun_samples; // samples dropped because the ring was full
+    _Atomic uint64_t latency_last; // time from writing a frame to the device pulling its first sample
+    _Atomic uint64_t latency_max;
+} audio_ring;
+
+void init_audio_ring(audio_ring *ring);
+uint32_t audio_ring_fill(audio_ring *ring);
+uint32_t audio_ring_write(audio_ring *ring, const float *samples, uint32_t count, uint64_t now);
+void audio_ring_read(audio_ring *ring, float *out, uint32_t count, uint64_t now);
+
+// Execute one 60Hz frame like run_frame(), rendering count beeper samples alongside it. The samples
+// are spread over the instructions, so a sound timer set or expiring mid frame is heard at that point.
+// Plays the XO-CHIP audio pattern instead of the fixed tone once the program has loaded one.
+void run_frame_audio(chip8_machine *chip8, instruction *instr, unsigned int instructions,
+                     square_wave *wave, float *out, int count);
+
+#endif // CHIP8_AUDIO_H
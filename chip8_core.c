@@ -0,0 +1,386 @@
+// CHIP-8 CPU core: machine reset, ROM loading, instruction execution and timers.
+// Has no SDL dependency, frontends (chip8.c, chip8_headless.c) link against it as libchip8.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+
+static const uint8_t fonts[] = { // Hex representation of hex characters that are 4 pixels wide and 5 pixels tall
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1      Example representation of 0:
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3                11110000 <-- 0xF0
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4                10010000 <-- 0x90
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5                10010000
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6                10010000
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7                11110000
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9       If you look at the outline
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A       of the 1's you can see the 0
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+static const uint8_t big_fonts[] = { // SUPER-CHIP 8 x 10 characters for FX30, 10 bytes each
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+    0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A     SUPER-CHIP 1.1 only had 0-9,
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B     A-F are what later
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C     interpreters added
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// FNV-1a, stored in the machine so movies can check they are played back on the ROM they were recorded on
+static uint64_t hash_rom(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// put the machine back into its power-on state, without touching the filesystem
+void reset_chip8(chip8_machine *chip8)
+{
+    memset(chip8->ram, 0, sizeof(chip8->ram));
+    memset(chip8->display, 0, sizeof(chip8->display));
+    chip8->planes = 1;
+    chip8->hires = false;
+    chip8->halted = false;
+    chip8->fault = FAULT_NONE;
+    chip8->fault_address = 0;
+    memset(chip8->rpl_flags, 0, sizeof(chip8->rpl_flags));
+    memset(chip8->audio_pattern, 0, sizeof(chip8->audio_pattern));
+    chip8->pitch = DEFAULT_PITCH;
+    chip8->audio_pattern_set = false;
+    chip8->keys = 0;
+    chip8->keys_latched = 0;
+    chip8->keys_observed = 0;
+    chip8->display_dirty = false;
+    chip8->ram_dirty = false;
+    chip8->keys_polled = false;
+    chip8->ram_pages_written = 0;
+    memset(chip8->stack, 0, sizeof(chip8->stack));
+    memset(chip8->data_registers, 0, sizeof(chip8->data_registers));
+    chip8->I = 0;
+    chip8->delay_timer = 0;
+    chip8->sound_timer = 0;
+    chip8->rng = DEFAULT_SEED;
+    chip8->profile = PROFILE_CHIP8;
+    chip8->vblank = true;
+    chip8->rom_hash = hash_rom(NULL, 0);
+
+    // load the fonts into the memory, starting from address 0x00
+    memcpy(&chip8->ram[0], fonts, sizeof(fonts));
+    memcpy(&chip8->ram[BIG_FONT_LOCATION], big_fonts, sizeof(big_fonts));
+
+    chip8->PC = BEGIN_LOCATION;
+    // initialize stack pointer to 0
+    chip8->cur_stack = 0;
+}
+
+// return success status of loading a ROM image that is already in memory (e.g. from a fuzzer)
+bool load_rom(chip8_machine *chip8, const uint8_t *rom_data, size_t rom_size)
+{
+    if (rom_size > RAM_SIZE - BEGIN_LOCATION) // same limit as init_chip8
+    {
+        return false;
+    }
+    reset_chip8(chip8);
+    if (rom_size > 0) // rom_data may be NULL for an empty ROM (e.g. a mapped empty file)
+    {
+        memcpy(&chip8->ram[BEGIN_LOCATION], rom_data, rom_size);
+    }
+    chip8->rom_hash = hash_rom(rom_data, rom_size);
+    return true;
+}
+
+// return success status of CHIP-8 initialization. Single files are read with stdio: mapping a
+// ROM of a few hundred bytes costs more than reading it, batches use a mapped archive (chip8_archive.h)
+bool init_chip8(chip8_machine *chip8, const char *rom_file)
+{
+    reset_chip8(chip8);
+
+    // open ROM, whose name can be passed in from the command line
+    FILE *rom = fopen(rom_file, "rb");
+    if (!rom)
+    {
+        fprintf(stderr, "Could not find file %s\n", rom_file);
+        return false;
+    }
+    // get file size
+    fseek(rom, 0, SEEK_END);
+    long file_size = ftell(rom);
+
+    long max_size = RAM_SIZE - BEGIN_LOCATION;
+    rewind(rom); // rewind to beginning of file, don't want to be at the end of file because of above fseek
+
+    if(file_size < 0) // not a regular file
+    {
+        fprintf(stderr, "Could not load file %s into memory\n", rom_file);
+        fclose(rom);
+        return false;
+    }
+    if(file_size > max_size) // file is bigger than memory, can't load it
+    {
+        fprintf(stderr, "File %s is too large. ROM size: %ld, Max size: %ld\n", rom_file, file_size, max_size);
+        fclose(rom);
+        return false;
+    }
+
+    // load ROM
+    if (fread(&chip8->ram[BEGIN_LOCATION], file_size, 1, rom) != 1)
+    {
+        fprintf(stderr, "Could not load file %s into memory\n", rom_file);
+        fclose(rom);
+        return false;
+    }
+    chip8->rom_hash = hash_rom(&chip8->ram[BEGIN_LOCATION], file_size);
+
+    fclose(rom);
+    return true;
+}
+
+// restart the CXNN random sequence, runs with the same seed and input are identical
+void seed_chip8(chip8_machine *chip8, uint32_t seed)
+{
+    chip8->rng = seed ? seed : DEFAULT_SEED; // xorshift would stay at 0 forever
+}
+
+// clear the planes selected by mask
+static void clear_display(chip8_machine *chip8, uint8_t mask)
+{
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++)
+    {
+        if (mask & (1 << plane))
+        {
+            memset(chip8->display[plane], 0, sizeof(chip8->display[plane]));
+        }
+    }
+    chip8->display_dirty = true;
+}
+
+// SUPER-CHIP / XO-CHIP scrolls of the selected planes, by pixels of the current mode. Rows move with
+// one memmove, columns are shifted a word at a time, carrying the bits that cross from one word into
+// the other. down is negative to scroll up
+static void scroll_vertical(chip8_machine *chip8, int down)
+{
+    unsigned int height = display_height(chip8);
+    unsigned int rows = down < 0 ? -down : down;
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++)
+    {
+        if (!(chip8->planes & (1 << plane)))
+        {
+            continue;
+        }
+        uint64_t (*display)[2] = chip8->display[plane];
+        if (down > 0)
+        {
+            memmove(display[rows], display[0], (height - rows) * sizeof(display[0]));
+            memset(display[0], 0, rows * sizeof(display[0]));
+        }
+        else
+        {
+            memmove(display[0], display[rows], (height - rows) * sizeof(display[0]));
+            memset(display[height - rows], 0, rows * sizeof(display[0]));
+        }
+    }
+    chip8->display_dirty = true;
+}
+
+static void scroll_right(chip8_machine *chip8, unsigned int columns)
+{
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++)
+    {
+        for (unsigned int y = 0; (chip8->planes & (1 << plane)) && y < display_height(chip8); y++)
+        {
+            uint64_t *row = chip8->display[plane][y];
+            row[1] = chip8->hires ? (row[1] >> columns) | (row[0] << (64 - columns)) : 0; // lo-res ends at x 63
+            row[0] >>= columns;
+        }
+    }
+    chip8->display_dirty = true;
+}
+
+static void scroll_left(chip8_machine *chip8, unsigned int columns)
+{
+    for (int plane = 0; plane < DISPLAY_PLANES; plane++)
+    {
+        for (unsigned int y = 0; (chip8->planes & (1 << plane)) && y < display_height(chip8); y++)
+        {
+            uint64_t *row = chip8->display[plane][y];
+            row[0] = (row[0] << columns) | (row[1] >> (64 - columns));
+            row[1] <<= columns;
+        }
+    }
+    chip8->display_dirty = true;
+}
+
+// record fault against the current instruction if faulted and it is the machine's first, and halt
+// it. Without branches: the instruction runs regardless, the guard and the masked stack pointer keep
+// it inside the machine
+static inline void record_fault(chip8_machine *chip8, bool faulted, uint8_t fault)
+{
+    bool first = faulted & (chip8->fault == FAULT_NONE);
+    chip8->fault = first ? fault : chip8->fault;
+    chip8->fault_address = first ? chip8->PC - 2 : chip8->fault_address;
+    chip8->halted |= faulted;
+}
+
+// record a fault if an access to bytes bytes from I (at most RAM_GUARD) runs past the end of RAM
+static inline void check_memory(chip8_machine *chip8, unsigned int bytes)
+{
+    record_fault(chip8, chip8->I + bytes > RAM_SIZE, FAULT_MEMORY);
+}
+
+// note a write of bytes bytes from I (at most RAM_GUARD, so at most two pages) in ram_dirty and ram_pages_written
+static inline void mark_memory_written(chip8_machine *chip8, unsigned int bytes)
+{
+    chip8->ram_dirty = true;
+    chip8->ram_pages_written |= 1u << (chip8->I / RAM_PAGE_SIZE) | 1u << ((chip8->I + bytes - 1) / RAM_PAGE_SIZE);
+}
+
+// skip the next instruction, which is two words long if it is XO-CHIP F000 NNNN
+static void skip_instruction(chip8_machine *chip8)
+{
+    bool long_instruction = chip8->ram[chip8->PC] == 0xF0 && chip8->ram[(chip8->PC + 1) & 0xFFFF] == 0x00;
+    chip8->PC += long_instruction ? 4 : 2;
+}
+
+// One specialised interpreter per quirk profile, see chip8_interpreter.h
+
+// COSMAC VIP CHIP-8
+#define INTERPRETER(name) name##_chip8
+#define QUIRK_VF_RESET 1
+#define QUIRK_MEMORY_INCREMENT_I 1
+#define QUIRK_SHIFT_USES_VY 1
+#define QUIRK_JUMP_VX 0
+#define QUIRK_WRAP_SPRITES 0
+#define QUIRK_DISPLAY_WAIT 1
+#include "chip8_interpreter.h"
+
+// SUPER-CHIP 1.1
+#define INTERPRETER(name) name##_schip
+#define QUIRK_VF_RESET 0
+#define QUIRK_MEMORY_INCREMENT_I 0
+#define QUIRK_SHIFT_USES_VY 0
+#define QUIRK_JUMP_VX 1
+#define QUIRK_WRAP_SPRITES 0
+#define QUIRK_DISPLAY_WAIT 0
+#include "chip8_interpreter.h"
+
+// XO-CHIP (Octo)
+#define INTERPRETER(name) name##_xochip
+#define QUIRK_VF_RESET 0
+#define QUIRK_MEMORY_INCREMENT_I 1
+#define QUIRK_SHIFT_USES_VY 1
+#define QUIRK_JUMP_VX 0
+#define QUIRK_WRAP_SPRITES 1
+#define QUIRK_DISPLAY_WAIT 0
+#include "chip8_interpreter.h"
+
+static void (*const interpreters[PROFILE_COUNT])(chip8_machine *, instruction *) = {
+    [PROFILE_CHIP8] = execute_chip8,
+    [PROFILE_SCHIP] = execute_schip,
+    [PROFILE_XOCHIP] = execute_xochip,
+};
+
+static void (*const frame_runners[PROFILE_COUNT])(chip8_machine *, instruction *, unsigned int) = {
+    [PROFILE_CHIP8] = run_frame_chip8,
+    [PROFILE_SCHIP] = run_frame_schip,
+    [PROFILE_XOCHIP] = run_frame_xochip,
+};
+
+static unsigned int (*const sound_runners[PROFILE_COUNT])(chip8_machine *, instruction *, unsigned int) = {
+    [PROFILE_CHIP8] = run_until_sound_chip8,
+    [PROFILE_SCHIP] = run_until_sound_schip,
+    [PROFILE_XOCHIP] = run_until_sound_xochip,
+};
+
+static const char *const profile_names[PROFILE_COUNT] = {
+    [PROFILE_CHIP8] = "chip8",
+    [PROFILE_SCHIP] = "schip",
+    [PROFILE_XOCHIP] = "xochip",
+};
+
+// fetch, decode and execute one instruction with the interpreter of the machine's profile
+void execute_instruction(chip8_machine *chip8, instruction *instr)
+{
+    interpreters[chip8->profile](chip8, instr);
+}
+
+// return success status of looking up a profile by its name (chip8, schip or xochip)
+bool parse_profile(const char *name, quirk_profile *profile)
+{
+    for (int i = 0; i < PROFILE_COUNT; i++)
+    {
+        if (strcmp(name, profile_names[i]) == 0)
+        {
+            *profile = (quirk_profile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *profile_name(quirk_profile profile)
+{
+    return profile < PROFILE_COUNT ? profile_names[profile] : "unknown";
+}
+
+const char *fault_name(chip8_fault fault)
+{
+    static const char *const fault_names[FAULT_COUNT] = {
+        [FAULT_NONE] = "none",
+        [FAULT_STACK_OVERFLOW] = "stack overflow",
+        [FAULT_STACK_UNDERFLOW] = "stack underflow",
+        [FAULT_MEMORY] = "memory access past the end of RAM",
+    };
+    return fault < FAULT_COUNT ? fault_names[fault] : "unknown";
+}
+
+// count both timers down by one tick and start a new vertical blank (called at 60Hz)
+void tick_timers(chip8_machine *chip8)
+{
+    if (chip8->delay_timer > 0)
+        chip8->delay_timer--;
+
+    if (chip8->sound_timer > 0)
+        chip8->sound_timer--;
+
+    chip8->vblank = true;
+}
+
+// execute one 60Hz frame worth of instructions, then tick the timers. The profile is looked up once
+// per frame, the instructions run in the specialised interpreter's own loop
+void run_frame(chip8_machine *chip8, instruction *instr, unsigned int instructions)
+{
+    frame_runners[chip8->profile](chip8, instr, instructions);
+}
+
+// execute up to instructions instructions in the specialised interpreter's loop, without ticking the
+// timers, stopping right after one that changes what the beeper plays (FX18, FX3A, F002). Returns
+// how many ran, so audio can be rendered in stretches of unchanged sound (see run_frame_audio())
+unsigned int run_until_sound(chip8_machine *chip8, instruction *instr, unsigned int instructions)
+{
+    return sound_runners[chip8->profile](chip8, instr, instructions);
+}
@@ -0,0 +1,267 @@
+// Batched environments, see chip8_env.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_env.h"
+#include "chip8_hang.h"
+#include "chip8_lockstep.h"
+
+// bytes of one machine's observation, machine i's starts i times this far into the observations
+size_t env_observation_size(const env_config *config)
+{
+    size_t pixels = config->hires ? HIRES_WIDTH * HIRES_HEIGHT : DISPLAY_WIDTH * DISPLAY_HEIGHT;
+    return config->observation == ENV_OBSERVE_BYTES ? pixels : pixels / 8 * config->planes;
+}
+
+// the reward number: reward_bytes bytes at reward_address, big endian like CHIP-8 itself
+static uint32_t read_score(const chip8_envs *envs, const chip8_machine *chip8)
+{
+    uint32_t score = 0;
+    for (unsigned int i = 0; i < envs->config.reward_bytes; i++)
+    {
+        score = score << 8 | chip8->ram[(envs->config.reward_address + i) & 0xFFFF];
+    }
+    return score;
+}
+
+// Make chip8 a copy of envs->initial. Of the RAM only the pages that can differ are copied: those of
+// the initial machine that aren't zero and those the episode wrote to, the machine starts out zeroed.
+// The pages a ROM never touches stay zero pages the system hasn't backed with memory
+static void restore_machine(const chip8_envs *envs, chip8_machine *chip8)
+{
+    const chip8_machine *initial = envs->initial;
+    uint32_t pages = envs->initial_pages | chip8->ram_pages_written;
+    for (uint32_t page = 0; page * RAM_PAGE_SIZE < sizeof(chip8->ram); page++)
+    {
+        if (pages >> page & 1)
+        {
+            size_t offset = page * RAM_PAGE_SIZE;
+            size_t size = sizeof(chip8->ram) - offset < RAM_PAGE_SIZE ? sizeof(chip8->ram) - offset : RAM_PAGE_SIZE;
+            memcpy(&chip8->ram[offset], &initial->ram[offset], size);
+        }
+    }
+    memcpy((uint8_t *)chip8 + sizeof(chip8->ram), (const uint8_t *)initial + sizeof(chip8->ram),
+           sizeof(chip8_machine) - sizeof(chip8->ram));
+}
+
+static void start_episode(chip8_envs *envs, uint32_t i)
+{
+    chip8_machine *chip8 = &envs->machines[i];
+    restore_machine(envs, chip8); // a complete snapshot, like a struct copy
+    seed_chip8(chip8, envs->config.seed + i + envs->episodes[i] * envs->count);
+    chip8->profile = envs->config.profile;
+    init_hang_detector(&envs->hangs[i], envs->config.hang_frames);
+    envs->frames[i] = 0;
+    envs->episodes[i]++;
+    envs->scores[i] = read_score(envs, chip8);
+    envs->ended[i] = false;
+}
+
+// 8 pixels, most significant bit first, to one byte each: byte i (bits 8i up) of the result is bit
+// 7 - i of bits, 0 or 1
+static inline uint64_t spread_bits(uint64_t bits)
+{
+    return ((bits * 0x8040201008040201ULL) & 0x8080808080808080ULL) >> 7;
+}
+
+// write the screen straight from the packed display words
+static void observe(const chip8_envs *envs, const chip8_machine *chip8, uint8_t *out)
+{
+    unsigned int width = envs->config.hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    unsigned int height = envs->config.hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    if (envs->config.observation == ENV_OBSERVE_BYTES)
+    {
+        for (unsigned int y = 0; y < height; y++)
+        {
+            for (unsigned int word = 0; word < width / 64; word++)
+            {
+                uint64_t plane0 = chip8->display[0][y][word], plane1 = chip8->display[1][y][word];
+                for (int shift = 56; shift >= 0; shift -= 8)
+                {
+                    uint64_t pixels = spread_bits((plane0 >> shift) & 0xFF) | spread_bits((plane1 >> shift) & 0xFF) << 1;
+                    for (int i = 0; i < 8; i++)
+                    {
+                        *out++ = (uint8_t)(pixels >> (8 * i)); // display_pixel() of 8 pixels
+                    }
+                }
+            }
+        }
+        return;
+    }
+    for (unsigned int plane = 0; plane < envs->config.planes; plane++)
+    {
+        for (unsigned int y = 0; y < height; y++)
+        {
+            for (unsigned int word = 0; word < width / 64; word++)
+            {
+                uint64_t bits = chip8->display[plane][y][word];
+                for (int byte = 0; byte < 8; byte++)
+                {
+                    *out++ = (uint8_t)(bits >> (56 - 8 * byte));
+                }
+            }
+        }
+    }
+}
+
+// return success status of loading the ROM into count machines, which start their first episode.
+// The config is checked here, errors are printed
+bool create_envs(chip8_envs *envs, uint32_t count, const uint8_t *rom, size_t rom_size, const env_config *config)
+{
+    return create_envs_at(envs, NULL, count, rom, rom_size, config);
+}
+
+// create_envs() with the machines kept in the caller's memory, room for count of them and zeroed
+// (fresh shared memory is), such as a region shared with other processes. NULL allocates them like
+// create_envs()
+bool create_envs_at(chip8_envs *envs, chip8_machine *machines, uint32_t count, const uint8_t *rom, size_t rom_size,
+                    const env_config *config)
+{
+    memset(envs, 0, sizeof(*envs));
+    if (count == 0 || config->profile >= PROFILE_COUNT || config->reward_bytes > 4
+        || (config->observation == ENV_OBSERVE_BITS && (config->planes < 1 || config->planes > DISPLAY_PLANES)))
+    {
+        fprintf(stderr, "Invalid environment configuration\n");
+        return false;
+    }
+    envs->config = *config;
+    envs->count = count;
+    envs->own_machines = !machines;
+    envs->machines = machines ? machines : calloc(count, sizeof(chip8_machine));
+    envs->initial = calloc(1, sizeof(chip8_machine)); // zeroed padding too, episodes start byte for byte alike
+    envs->hangs = malloc(count * sizeof(hang_detector));
+    envs->frames = calloc(count, sizeof(uint32_t));
+    envs->episodes = calloc(count, sizeof(uint32_t));
+    envs->scores = calloc(count, sizeof(uint32_t));
+    envs->ended = calloc(count, sizeof(uint8_t));
+    if (!envs->machines || !envs->initial || !envs->hangs || !envs->frames || !envs->episodes || !envs->scores
+        || !envs->ended)
+    {
+        fprintf(stderr, "Out of memory for %u environments\n", count);
+        destroy_envs(envs);
+        return false;
+    }
+    if (!load_rom(envs->initial, rom, rom_size))
+    {
+        fprintf(stderr, "ROM is too large\n");
+        destroy_envs(envs);
+        return false;
+    }
+    for (uint32_t offset = 0; offset < sizeof(envs->initial->ram); offset++)
+    {
+        envs->initial_pages |= (uint32_t)(envs->initial->ram[offset] != 0) << offset / RAM_PAGE_SIZE;
+    }
+    reset_envs(envs);
+    return true;
+}
+
+// start a new episode on every machine
+void reset_envs(chip8_envs *envs)
+{
+    for (uint32_t i = 0; i < envs->count; i++)
+    {
+        start_episode(envs, i);
+    }
+}
+
+// the end of machine i's step: its observation, done flag and reward
+static void finish_step(chip8_envs *envs, uint32_t i, bool ended, uint8_t *observations, uint8_t *done,
+                        float *rewards)
+{
+    chip8_machine *chip8 = &envs->machines[i];
+    if (observations)
+    {
+        observe(envs, chip8, observations + i * env_observation_size(&envs->config));
+    }
+    envs->ended[i] = ended;
+    done[i] = ended;
+    if (rewards)
+    {
+        uint32_t score = read_score(envs, chip8);
+        rewards[i] = (float)((int64_t)score - (int64_t)envs->scores[i]);
+        envs->scores[i] = score;
+    }
+}
+
+// whether machine i's episode is over after the frame it just ran
+static bool episode_over(chip8_envs *envs, uint32_t i)
+{
+    chip8_machine *chip8 = &envs->machines[i];
+    envs->frames[i]++;
+    return chip8->halted || (envs->config.hang_frames && check_hang(&envs->hangs[i], chip8) != HANG_NONE)
+           || envs->frames[i] == envs->config.max_frames;
+}
+
+// Hold actions[i] (a key mask, bit K for key K) on machine i for frames_per_step frames, or until its
+// episode ends. Then write every machine's screen to observations, env_observation_size() bytes
+// each, whether its episode is over to done[i], and the change of its reward number to rewards[i]
+// (rewards may be NULL). Machines that were done at the last step start a new episode first.
+// observations may be NULL too, for callers that read the screens from the machines' display.
+void step_envs(chip8_envs *envs, const uint16_t *actions, unsigned int frames_per_step,
+               uint8_t *observations, uint8_t *done, float *rewards)
+{
+    for (uint32_t i = 0; i < envs->count; i++)
+    {
+        if (envs->ended[i])
+        {
+            start_episode(envs, i);
+        }
+        envs->machines[i].keys = actions[i];
+    }
+
+    if (envs->config.lockstep)
+    {
+        // frame by frame over the machines whose episode goes on, one that ended stays as it was until
+        // its next step like in the loop below
+        for (unsigned int frame = 0; frame < frames_per_step; frame++)
+        {
+            run_frame_lockstep(envs->machines, envs->count, envs->config.instructions_per_frame, envs->ended, NULL);
+            for (uint32_t i = 0; i < envs->count; i++)
+            {
+                if (!envs->ended[i] && episode_over(envs, i))
+                {
+                    finish_step(envs, i, true, observations, done, rewards);
+                }
+            }
+        }
+        for (uint32_t i = 0; i < envs->count; i++)
+        {
+            if (!envs->ended[i])
+            {
+                finish_step(envs, i, false, observations, done, rewards);
+            }
+        }
+        return;
+    }
+
+    instruction instr;
+    for (uint32_t i = 0; i < envs->count; i++)
+    {
+        bool ended = false;
+        for (unsigned int frame = 0; frame < frames_per_step && !ended; frame++)
+        {
+            run_frame(&envs->machines[i], &instr, envs->config.instructions_per_frame);
+            ended = episode_over(envs, i);
+        }
+        finish_step(envs, i, ended, observations, done, rewards);
+    }
+}
+
+void destroy_envs(chip8_envs *envs)
+{
+    if (envs->own_machines)
+    {
+        free(envs->machines);
+    }
+    free(envs->initial);
+    free(envs->hangs);
+    free(envs->frames);
+    free(envs->episodes);
+    free(envs->scores);
+    free(envs->ended);
+    memset(envs, 0, sizeof(*envs));
+}
@@ -0,0 +1,63 @@
+// Batched environments: many machines running the same ROM, stepped together with one call, part of
+// libchip8. Meant for reinforcement learning loops that step thousands of games per batch: actions
+// come in as one array, observations, done flags and rewards go out into caller buffers laid out
+// back to back, so nothing is converted or copied per machine on the caller's side.
+#ifndef CHIP8_ENV_H
+#define CHIP8_ENV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "chip8_hang.h"
+
+typedef enum {
+    ENV_OBSERVE_BITS, // 1 bit per pixel, most significant bit first, a row is width / 8 bytes
+    ENV_OBSERVE_BYTES, // 1 byte per pixel, its colour 0-3 (display_pixel())
+} env_observation;
+
+typedef struct {
+    quirk_profile profile;
+    unsigned int instructions_per_frame;
+    uint32_t seed; // machine i starts episode e with seed + i + e * count
+    env_observation observation;
+    bool hires; // observe the whole 128 x 64 framebuffer instead of the 64 x 32 CHIP-8 screen
+    uint8_t planes; // bitplanes observed in ENV_OBSERVE_BITS, 1 or 2, plane 1 follows plane 0
+    uint32_t max_frames; // episode length limit, 0 for none
+    uint32_t hang_frames; // end an episode that made no progress for this many frames (chip8_hang.h), 0 for never
+    uint16_t reward_address; // reward: change of the big endian number of reward_bytes bytes here,
+    uint8_t reward_bytes; // typically a score, 0-4, 0 for no rewards
+    bool lockstep; // step the machines with run_frame_lockstep() (chip8_lockstep.h), same results
+} env_config;
+
+// Every machine is a whole chip8_machine, about 70kb of address space, kept in one array: 65536
+// machines take 4.4gb of it, whatever the profile. Only the 4kb RAM pages a ROM loads into or
+// writes to are ever touched (ram_pages_written), the rest stay zero pages the system hasn't
+// backed, so a CHIP-8 or SUPER-CHIP machine takes about 10kb of memory, 650mb for 65536. A machine
+// whose episode ended (00FD, a fault, max_frames or a hang) reports done and is reset to the start
+// of a new episode at its next step.
+typedef struct {
+    env_config config;
+    uint32_t count;
+    chip8_machine *machines;
+    bool own_machines; // machines was allocated by create_envs(), not given to create_envs_at()
+    chip8_machine *initial; // the machine right after loading the ROM, what episodes start from
+    uint32_t initial_pages; // bit P is set if RAM page P of initial isn't all zero
+    hang_detector *hangs;
+    uint32_t *frames; // frames into the current episode
+    uint32_t *episodes; // episodes started
+    uint32_t *scores; // reward number at the last step
+    uint8_t *ended; // episode over, reset before the next step
+} chip8_envs;
+
+size_t env_observation_size(const env_config *config);
+bool create_envs(chip8_envs *envs, uint32_t count, const uint8_t *rom, size_t rom_size, const env_config *config);
+bool create_envs_at(chip8_envs *envs, chip8_machine *machines, uint32_t count, const uint8_t *rom, size_t rom_size,
+                    const env_config *config);
+void reset_envs(chip8_envs *envs);
+void step_envs(chip8_envs *envs, const uint16_t *actions, unsigned int frames_per_step,
+               uint8_t *observations, uint8_t *done, float *rewards);
+void destroy_envs(chip8_envs *envs);
+
+#endif // CHIP8_ENV_H
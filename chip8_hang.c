@@ -0,0 +1,101 @@
+// Hang detection, see chip8_hang.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_hang.h"
+
+static const char *const hang_names[HANG_KIND_COUNT] = {
+    [HANG_NONE] = "running",
+    [HANG_EXITED] = "exited (00FD)",
+    [HANG_FAULT] = "faulted",
+    [HANG_SELF_JUMP] = "halted on self-jump",
+    [HANG_WAIT_KEY] = "waiting for key",
+    [HANG_STUCK_LOOP] = "stuck loop",
+};
+
+void init_hang_detector(hang_detector *detector, uint32_t frames)
+{
+    detector->frames = frames;
+    detector->idle_frames = 0;
+    detector->polled = false;
+    detector->closed = false;
+    detector->loop_low = 0;
+    detector->loop_high = 0;
+}
+
+static void capture_state(hang_state *state, const chip8_machine *chip8)
+{
+    memset(state, 0, sizeof(*state)); // compared with memcmp, padding included
+    memcpy(state->V, chip8->data_registers, sizeof(state->V));
+    memcpy(state->stack, chip8->stack, sizeof(state->stack));
+    state->I = chip8->I;
+    state->PC = chip8->PC;
+    state->keys_latched = chip8->keys_latched;
+    state->sp = chip8->cur_stack;
+    state->rng = chip8->rng;
+}
+
+// call once after every frame. Consumes the machine's ram_dirty, display_dirty and keys_polled
+// flags, so it takes the place of a frontend presenting the display
+hang_kind check_hang(hang_detector *detector, chip8_machine *chip8)
+{
+    if (chip8->halted)
+    {
+        return chip8->fault != FAULT_NONE ? HANG_FAULT : HANG_EXITED;
+    }
+    uint16_t pc = chip8->PC;
+    uint16_t opcode = chip8->ram[pc] << 8 | chip8->ram[(pc + 1) & 0xFFFF];
+    if (opcode == (0x1000 | pc)) // nothing but the timers will ever change again
+    {
+        detector->loop_low = detector->loop_high = pc;
+        return HANG_SELF_JUMP;
+    }
+
+    bool progress = chip8->ram_dirty || chip8->display_dirty || chip8->delay_timer > 0 || chip8->sound_timer > 0;
+    bool polled = chip8->keys_polled;
+    chip8->ram_dirty = false;
+    chip8->display_dirty = false;
+    chip8->keys_polled = false;
+    if (progress)
+    {
+        detector->idle_frames = 0;
+        detector->polled = false;
+        return HANG_NONE;
+    }
+
+    hang_state state;
+    capture_state(&state, chip8);
+    if (detector->idle_frames == 0)
+    {
+        detector->loop_low = detector->loop_high = pc;
+        detector->closed = false;
+        detector->saved = state;
+        detector->since_saved = 0;
+        detector->save_every = 1;
+    }
+    else if (!detector->closed)
+    {
+        detector->closed = memcmp(&state, &detector->saved, sizeof(state)) == 0;
+        if (++detector->since_saved == detector->save_every)
+        {
+            detector->saved = state;
+            detector->since_saved = 0;
+            detector->save_every *= 2;
+        }
+    }
+    detector->loop_low = pc < detector->loop_low ? pc : detector->loop_low;
+    detector->loop_high = pc > detector->loop_high ? pc : detector->loop_high;
+    detector->polled |= polled;
+    if (++detector->idle_frames < detector->frames || !detector->closed)
+    {
+        return HANG_NONE;
+    }
+    return detector->polled ? HANG_WAIT_KEY : HANG_STUCK_LOOP;
+}
+
+const char *hang_name(hang_kind kind)
+{
+    return kind < HANG_KIND_COUNT ? hang_names[kind] : "unknown";
+}
@@ -0,0 +1,57 @@
+// Hang detection for headless and batch runs, part of libchip8. A machine that stopped making
+// progress is reported with what it is stuck on, so a batch can retire it early instead of
+// running it for its whole frame budget.
+#ifndef CHIP8_HANG_H
+#define CHIP8_HANG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define DEFAULT_HANG_FRAMES 120 // two seconds of emulated time without progress
+
+typedef enum {
+    HANG_NONE, // still making progress, or not idle for long enough yet
+    HANG_EXITED, // SUPER-CHIP 00FD
+    HANG_FAULT, // did something a correct program never does, see chip8_machine.fault
+    HANG_SELF_JUMP, // a 1NNN jumping to itself, the usual way of ending a CHIP-8 program
+    HANG_WAIT_KEY, // idle while waiting for a key (FX0A) or polling the keypad (EX9E/EXA1)
+    HANG_STUCK_LOOP, // idle in a closed loop that neither reads keys nor changes RAM, display or timers
+    HANG_KIND_COUNT
+} hang_kind;
+
+// Everything an idle machine's next frame depends on, apart from RAM, display and input
+typedef struct {
+    uint8_t V[16];
+    uint16_t stack[STACK_SLOTS];
+    uint16_t I;
+    uint16_t PC;
+    uint16_t keys_latched;
+    uint8_t sp;
+    uint32_t rng;
+} hang_state;
+
+// Progress is a RAM write, a display change or a running timer. Without any, a frame only depends
+// on the registers, stack, RNG and PC it starts with (and on input), so once those repeat at the end
+// of an idle frame the machine is in a closed loop it can't get out of on its own. A hang is at
+// least frames idle frames with such a repeat among them: a delay loop that only counts registers
+// down is idle but never repeats. Repeats are found with Brent's cycle detection, one saved state
+// compared at the end of every idle frame. Self-jumps, 00FD and faults are final the moment they
+// show up and are reported right away.
+typedef struct {
+    uint32_t frames; // idle frames that make a hang
+    uint32_t idle_frames; // idle frames so far
+    bool polled; // the keypad was looked at in the idle frames
+    bool closed; // the idle frames repeated a state: a closed loop
+    uint32_t since_saved; // idle frames since saved was taken
+    uint32_t save_every; // power of two, saved is replaced after this many frames without a repeat
+    hang_state saved;
+    uint16_t loop_low, loop_high; // PCs seen at the ends of the idle frames, roughly where the loop is
+} hang_detector;
+
+void init_hang_detector(hang_detector *detector, uint32_t frames);
+hang_kind check_hang(hang_detector *detector, chip8_machine *chip8);
+const char *hang_name(hang_kind kind);
+
+#endif // CHIP8_HANG_H
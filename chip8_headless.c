@@ -0,0 +1,250 @@
+// Headless frontend: runs a ROM without a window, audio or keyboard, as fast as the host allows.
+//
+//   chip8-headless ROM [--frames N] [--ipf N] [--seed N] [--profile NAME] [--romdb DB] [--archive FILE]
+//                      [--play MOVIE] [--hang-frames K] [--dump] [--wav FILE] [--wav-rate HZ]
+//
+// Meant for batch jobs and for embedding tests: it only links libchip8. --dump prints the final
+// screen as text. --wav renders the beeper into a WAV file in the same pass as the emulation,
+// sample accurate (see run_frame_audio()) and without needing an audio device. --play feeds the
+// input of a movie recorded by the SDL frontend, with its seed and timing, and by default runs as
+// many frames as it holds, reproducing the recorded session at full speed. --profile picks the
+// quirks the ROM was written for: chip8 (COSMAC VIP, the default), schip or xochip. ROMs found in
+// the ROM database (chip8.romdb, or --romdb DB) get its profile and speed unless --profile or --ipf
+// say otherwise. With --archive, ROM is the name or hex hash of a ROM in an archive made by
+// tools/pack.c, loaded straight from the mapped archive. --hang-frames stops the run once the ROM
+// has made no progress for K frames and is in a closed loop (see chip8_hang.h), and says what it is
+// stuck on.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_archive.h"
+#include "chip8_audio.h"
+#include "chip8_hang.h"
+#include "chip8_movie.h"
+#include "chip8_romdb.h"
+#include "chip8_wav.h"
+
+#define DEFAULT_FRAMES 600 // 10 seconds of emulated time
+
+// print the screen as text, one character per pixel
+void dump_display(const chip8_machine *chip8)
+{
+    for (unsigned int y = 0; y < display_height(chip8); y++)
+    {
+        for (unsigned int x = 0; x < display_width(chip8); x++)
+        {
+            putchar(".#+@"[display_pixel(chip8, x, y)]); // off, plane 0, XO-CHIP plane 1, both
+        }
+        putchar('\n');
+    }
+}
+
+int main(int argc, char **argv) {
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s ROM [--frames N] [--ipf N] [--seed N] [--profile NAME] [--romdb DB] [--archive FILE] [--play MOVIE] [--hang-frames K] [--dump] [--wav FILE] [--wav-rate HZ]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long frames = DEFAULT_FRAMES;
+    bool frames_set = false;
+    unsigned int instructions_per_frame = INSTRUCTIONS_PER_FRAME;
+    bool ipf_set = false;
+    uint32_t seed = DEFAULT_SEED;
+    quirk_profile profile = PROFILE_CHIP8;
+    bool profile_set = false;
+    const char *romdb_path = NULL; // NULL: DEFAULT_ROMDB if there is one
+    const char *archive_path = NULL;
+    uint32_t hang_frames = 0; // 0: run every frame, however stuck the ROM is
+    const char *movie_path = NULL;
+    bool dump = false;
+    const char *wav_path = NULL;
+    int wav_rate = AUDIO_SAMPLE_RATE;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frames = strtoul(argv[++i], NULL, 10);
+            frames_set = true;
+        }
+        else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc)
+        {
+            instructions_per_frame = (unsigned int)strtoul(argv[++i], NULL, 10);
+            ipf_set = true;
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            if (!parse_profile(argv[++i], &profile))
+            {
+                fprintf(stderr, "Unknown profile %s (chip8, schip or xochip)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            profile_set = true;
+        }
+        else if (strcmp(argv[i], "--romdb") == 0 && i + 1 < argc)
+            romdb_path = argv[++i];
+        else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc)
+            archive_path = argv[++i];
+        else if (strcmp(argv[i], "--hang-frames") == 0 && i + 1 < argc)
+            hang_frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+            movie_path = argv[++i];
+        else if (strcmp(argv[i], "--dump") == 0)
+            dump = true;
+        else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc)
+            wav_path = argv[++i];
+        else if (strcmp(argv[i], "--wav-rate") == 0 && i + 1 < argc)
+            wav_rate = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Initialize CHIP-8 Machine
+    static chip8_machine chip8; // static, the machine is a few kilobytes
+    if (archive_path)
+    {
+        rom_archive archive;
+        archive_rom rom;
+        if (!open_archive(&archive, archive_path))
+        {
+            return 1;
+        }
+        char *end;
+        uint64_t hash = strtoull(argv[1], &end, 16);
+        bool found = find_archive_name(&archive, argv[1], &rom) || (*end == '\0' && find_archive_rom(&archive, hash, &rom));
+        bool loaded = found && load_rom(&chip8, rom.data, rom.size);
+        close_archive(&archive);
+        if (!found)
+        {
+            fprintf(stderr, "%s is not in %s\n", argv[1], archive_path);
+            return 1;
+        }
+        if (!loaded)
+        {
+            fprintf(stderr, "%s in %s does not fit in RAM\n", argv[1], archive_path);
+            return 1;
+        }
+    }
+    else if(!init_chip8(&chip8, argv[1]))
+    {
+        return 1;
+    }
+    seed_chip8(&chip8, seed);
+
+    // settings of a known ROM, the database is optional unless it was asked for
+    romdb db;
+    if (open_romdb(&db, romdb_path ? romdb_path : DEFAULT_ROMDB))
+    {
+        rom_info info;
+        if (find_rom(&db, chip8.rom_hash, &info))
+        {
+            profile = profile_set ? profile : (quirk_profile)info.profile;
+            instructions_per_frame = ipf_set ? instructions_per_frame : info.instructions_per_frame;
+        }
+        close_romdb(&db);
+    }
+    else if (romdb_path)
+    {
+        fprintf(stderr, "Could not open ROM database %s\n", romdb_path);
+        return 1;
+    }
+    chip8.profile = profile;
+
+    static movie mv;
+    if (movie_path)
+    {
+        if (!open_movie(&mv, movie_path) || !start_movie(&mv, &chip8))
+        {
+            return 1;
+        }
+        instructions_per_frame = mv.header.instructions_per_frame;
+        if (!frames_set)
+        {
+            frames = mv.header.frames;
+        }
+    }
+
+    if (wav_rate < 600 || wav_rate > 192000)
+    {
+        fprintf(stderr, "--wav-rate must be between 600 and 192000\n");
+        return 1;
+    }
+
+    instruction instr;
+    hang_detector hang;
+    init_hang_detector(&hang, hang_frames);
+    hang_kind hung = HANG_NONE;
+    unsigned long frame = 0;
+    if (wav_path)
+    {
+        static wav_writer wav; // static, holds the conversion buffer
+        static float frame_samples[192000 / 60 + 1];
+        static square_wave wave;
+        if (!open_wav(&wav, wav_path, wav_rate))
+        {
+            return 1;
+        }
+        init_square_wave(&wave, BEEP_FREQUENCY, wav_rate, BEEP_VOLUME);
+
+        for (; frame < frames && hung == HANG_NONE; frame++)
+        {
+            // samples of this frame, exact over time even when the rate is not a multiple of 60
+            if (movie_path)
+            {
+                play_movie_frame(&mv, &chip8.keys); // keys stay as they were once the movie ends
+            }
+            int count = (int)(((frame + 1) * (uint64_t)wav_rate) / 60 - (frame * (uint64_t)wav_rate) / 60);
+            run_frame_audio(&chip8, &instr, instructions_per_frame, &wave, frame_samples, count);
+            write_wav(&wav, frame_samples, count);
+            hung = hang_frames ? check_hang(&hang, &chip8) : HANG_NONE;
+        }
+        if (!close_wav(&wav))
+        {
+            fprintf(stderr, "Could not write %s\n", wav_path);
+            return 1;
+        }
+    }
+    else
+    {
+        for (; frame < frames && hung == HANG_NONE; frame++)
+        {
+            if (movie_path)
+            {
+                play_movie_frame(&mv, &chip8.keys);
+            }
+            run_frame(&chip8, &instr, instructions_per_frame);
+            hung = hang_frames ? check_hang(&hang, &chip8) : HANG_NONE;
+        }
+    }
+    if (movie_path && !close_movie(&mv))
+    {
+        fprintf(stderr, "Movie %s is truncated or unreadable\n", movie_path);
+        return 1;
+    }
+
+    printf("%s: ran %lu frames (%lu instructions), PC=%04X I=%04X%s", argv[1], frame,
+           frame * instructions_per_frame, chip8.PC, chip8.I, chip8.halted && chip8.fault == FAULT_NONE ? ", halted (00FD)" : "");
+    if (chip8.fault != FAULT_NONE)
+    {
+        printf(", faulted: %s at %04X", fault_name(chip8.fault), chip8.fault_address);
+    }
+    if (hung != HANG_NONE && hung != HANG_EXITED && hung != HANG_FAULT)
+    {
+        printf(", stopped: %s at %04X-%04X", hang_name(hung), hang.loop_low, hang.loop_high);
+    }
+    printf("\n");
+    if (dump)
+    {
+        dump_display(&chip8);
+    }
+    return 0;
+}
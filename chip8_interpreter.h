@@ -0,0 +1,420 @@
+// One CHIP-8 interpreter specialised for a quirk profile. Not a normal header: chip8_core.c includes
+// it once per profile, with the profile's behaviours defined as compile-time constants, and each
+// include expands to its own execute and run_frame functions. The quirk checks below are constant
+// conditions the compiler folds away, so a specialised interpreter has no quirk branches left.
+//
+// Defined by the includer:
+//   INTERPRETER(name)          names the functions of this instance, e.g. name##_schip
+//   QUIRK_VF_RESET             8XY1/8XY2/8XY3 set VF to 0
+//   QUIRK_MEMORY_INCREMENT_I   FX55/FX65 leave I pointing past the last register
+//   QUIRK_SHIFT_USES_VY        8XY6/8XYE shift VY into VX, instead of shifting VX in place
+//   QUIRK_JUMP_VX              BNNN is BXNN, a jump to XNN + VX instead of NNN + V0
+//   QUIRK_WRAP_SPRITES         sprites wrap around the screen edges instead of being clipped
+//   QUIRK_DISPLAY_WAIT         DXYN waits for the vertical blank (tick_timers()) before drawing
+
+static void INTERPRETER(execute)(chip8_machine *chip8, instruction *instr)
+{
+    // fetch instruction from RAM. Every access below is inside the machine without a bounds check:
+    // addresses are 16 bits, accesses from I end in the RAM guard at worst, the stack pointer is
+    // masked. Faults are only recorded, see record_fault()
+    uint16_t big_endian_opcode = chip8->ram[chip8->PC] << 8 | chip8->ram[(chip8->PC + 1) & 0xFFFF]; // this was done on x64 architecture which is little endian. Needed to convert opcode to big endian to match CHIP-8 system specs.
+    instr->opcode = big_endian_opcode;
+    chip8->PC += 2; // increment PC by 2 to start at next instruction (1 instruction is 2 bytes)
+
+    // instruction format
+    instr->N= instr->opcode & 0x0F;
+    instr->NN= instr->opcode & 0x0FF;
+    instr->NNN = instr->opcode & 0x0FFF;
+    instr->X = (instr->opcode >> 8)& 0x0F;
+    instr->Y = (instr->opcode >> 4) & 0x0F;
+    // printf("%04X %04X\n", PC ,instr->opcode);
+    // Emulate opcodes
+    switch((instr->opcode >> 12) & 0x0F){ // mask off first number in opcode
+        case 0x0:
+            if (instr->Y == 0xC){ // 00CN (SUPER-CHIP: scroll the display down N pixels)
+                scroll_vertical(chip8, instr->N);
+                break;
+            }
+            if (instr->Y == 0xD){ // 00DN (XO-CHIP: scroll the display up N pixels)
+                scroll_vertical(chip8, -instr->N);
+                break;
+            }
+            switch (instr->NN)
+            {
+            case 0xE0: // 00E0 (clear the screen, XO-CHIP: the selected planes)
+                clear_display(chip8, chip8->planes);
+                break;
+            case 0xEE: // 00EE (return from subroutine)
+                record_fault(chip8, chip8->cur_stack == 0, FAULT_STACK_UNDERFLOW);
+                chip8->cur_stack = (chip8->cur_stack - 1) & (STACK_SLOTS - 1); // pop the subroutine from the stack
+                chip8->PC = chip8->stack[chip8->cur_stack]; // PC now points to next instruction in the stack
+                // printf("Return from subroutine to address 0x%04X\n",
+                    //    (stack[cur_stack - 1]));
+                break;
+            case 0xFB: // 00FB (SUPER-CHIP: scroll the display right 4 pixels)
+                scroll_right(chip8, 4);
+                break;
+            case 0xFC: // 00FC (SUPER-CHIP: scroll the display left 4 pixels)
+                scroll_left(chip8, 4);
+                break;
+            case 0xFD: // 00FD (SUPER-CHIP: exit the interpreter), keep executing it so the machine stops here
+                chip8->halted = true;
+                chip8->PC -= 2;
+                break;
+            case 0xFE: // 00FE (SUPER-CHIP: 64 x 32 mode)
+                chip8->hires = false;
+                clear_display(chip8, 0xFF);
+                break;
+            case 0xFF: // 00FF (SUPER-CHIP: 128 x 64 mode)
+                chip8->hires = true;
+                clear_display(chip8, 0xFF);
+                break;
+            default:
+                break; // 0NNN (call a machine code routine) can't be supported
+            }
+            break;
+        case 0x01: // 1NNN (jump to address NNN)
+            chip8->PC = instr->NNN;
+            // printf("Jump to address NNN (0x%04X)\n",
+                //    instr->NNN);  
+            break;
+
+        case 0x02: // only 0x02 instruction is 2NNN (call subroutine at address NNN)
+            record_fault(chip8, chip8->cur_stack >= STACK_LEVELS, FAULT_STACK_OVERFLOW);
+            chip8->stack[chip8->cur_stack] = chip8->PC; // save current PC so we can return to it later
+            chip8->cur_stack = (chip8->cur_stack + 1) & (STACK_SLOTS - 1); // increment stack pointer by one
+            chip8->PC = instr->NNN; // jump to subroutine
+            // printf("Call subroutine at NNN (0x%04X)\n",
+            //        instr->NNN);
+            break;
+        case 0x03: // 3XNN (Skip next instruction if VX == NN)
+            if (chip8->data_registers[instr->X] == instr->NN){
+                skip_instruction(chip8);
+            }
+            break;
+        case 0x04: // 4XNN (Skip next instruction if VX != NN)
+            if (chip8->data_registers[instr->X] != instr->NN){
+                skip_instruction(chip8);
+            }
+            break;
+        case 0x05:
+            switch (instr->N)
+            {
+            case 0x0: // 5XY0 (Skip next instruction if VX == VY)
+                if (chip8->data_registers[instr->X] == chip8->data_registers[instr->Y]){
+                    skip_instruction(chip8);
+                }
+                break;
+            case 0x2: // 5XY2 (XO-CHIP: store VX...VY at address I onwards, in either direction, I is unchanged)
+            case 0x3: ;// 5XY3 (XO-CHIP: load VX...VY from address I onwards)
+                int step = instr->X <= instr->Y ? 1 : -1;
+                unsigned int count = (instr->X <= instr->Y ? instr->Y - instr->X : instr->X - instr->Y) + 1;
+                check_memory(chip8, count);
+                if (instr->N == 0x2){
+                    mark_memory_written(chip8, count);
+                }
+                for (int r = instr->X, i = 0;; r += step, i++)
+                {
+                    if (instr->N == 0x2){
+                        chip8->ram[chip8->I + i] = chip8->data_registers[r];
+                    }
+                    else{
+                        chip8->data_registers[r] = chip8->ram[chip8->I + i];
+                    }
+                    if (r == instr->Y){
+                        break;
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+            break;
+        case 0x06: // 6XNN (Sets VX to NN)
+            chip8->data_registers[instr->X] = instr->NN;
+            // printf("Set register V%X = NN (0x%02X)\n",
+            //        instr->X, instr->NN);
+                   break;
+        case 0x07: // 7XNN (Adds NN to)
+            chip8->data_registers[instr->X] += instr->NN; 
+            // printf("Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n",
+            //        instr->X, data_registers[instr->X], instr->NN,
+            //        data_registers[instr->X] + instr->NN);
+            break;
+        case 0x08:
+            switch(instr->N){// there are many 0x08 instructions, need further decoding than just the first nibble
+                case 0x00:
+                    chip8->data_registers[instr->X] = chip8->data_registers[instr->Y]; // 8XY0 (VX is set to the value of VY)
+                    break;
+                case 0x01:
+                    chip8->data_registers[instr->X] |= chip8->data_registers[instr->Y]; // 8XY1 (VX is set to VX OR VY)
+                    if (QUIRK_VF_RESET){
+                        chip8->data_registers[0xF] = 0;
+                    }
+                    break;
+                case 0x02:
+                    chip8->data_registers[instr->X] &= chip8->data_registers[instr->Y]; // 8XY2 (VX is set to VX AND VY)
+                    if (QUIRK_VF_RESET){
+                        chip8->data_registers[0xF] = 0;
+                    }
+                    break;
+                case 0x03:
+                    chip8->data_registers[instr->X] ^= chip8->data_registers[instr->Y]; // 8XY3 (VX is set to VX XOR VY)
+                    if (QUIRK_VF_RESET){
+                        chip8->data_registers[0xF] = 0;
+                    }
+                    break;
+                // the arithmetic and shifts write VF last, from the operands, so VF as X or Y still ends up holding the flag
+                case 0x04: ;// 8XY4 (VX is set to VX + VY)
+                    unsigned int sum = chip8->data_registers[instr->X] + chip8->data_registers[instr->Y];
+                    chip8->data_registers[instr->X] = (uint8_t)sum;
+                    chip8->data_registers[0xF] = sum > 0xFF; // if an overflow ocurred, set carry flag VF to 1, otherwise set it to 0
+                    break;
+                case 0x05: ;// 8XY5 (VX is set to VX - VY)
+                    bool no_borrow = chip8->data_registers[instr->X] >= chip8->data_registers[instr->Y]; // set carry flag to 1 if no underflow occurs, otherwise set to 0
+                    chip8->data_registers[instr->X] -= chip8->data_registers[instr->Y];
+                    chip8->data_registers[0xF] = no_borrow;
+                    break;
+                case 0x06: ;// 8XY6 (VX is set to VY >> 1, SUPER-CHIP: VX >> 1)
+                    uint8_t shifted = chip8->data_registers[QUIRK_SHIFT_USES_VY ? instr->Y : instr->X];
+                    chip8->data_registers[instr->X] = shifted >> 1;
+                    chip8->data_registers[0xF] = shifted & 1; // set carry flag to the bit that was shifted out
+                    break;
+                case 0x07: ;// 8XY7 (VX is set to VY - VX)
+                    no_borrow = chip8->data_registers[instr->Y] >= chip8->data_registers[instr->X];
+                    chip8->data_registers[instr->X] = chip8->data_registers[instr->Y] - chip8->data_registers[instr->X];
+                    chip8->data_registers[0xF] = no_borrow;
+                    break;
+                case 0x0E: ;// 8XYE (VX is set to VY << 1, SUPER-CHIP: VX << 1)
+                    shifted = chip8->data_registers[QUIRK_SHIFT_USES_VY ? instr->Y : instr->X];
+                    chip8->data_registers[instr->X] = shifted << 1;
+                    chip8->data_registers[0xF] = shifted >> 7;
+                    break;
+            }
+            break;
+        case 0x09: // 9XY0 (Skip next instruction if VX != VY)
+            if (chip8->data_registers[instr->X] != chip8->data_registers[instr->Y]){
+                skip_instruction(chip8);
+            }
+            break;
+        case 0x0A: // ANNN (Set I to address NNN)
+            chip8->I = instr->NNN;
+            // printf("Set I to NNN (0x%04X)\n",
+            //        instr->NNN);
+            break;
+        case 0x0B: // BNNN (Jump to address NNN plus V0, SUPER-CHIP: BXNN jumps to XNN plus VX)
+            chip8->PC = instr->NNN + chip8->data_registers[QUIRK_JUMP_VX ? instr->X : 0];
+            break;
+        case 0x0C: // CXNN (Generate a random number, binary AND it with NN, and store result in vX)
+            chip8->rng ^= chip8->rng << 13; // xorshift32
+            chip8->rng ^= chip8->rng >> 17;
+            chip8->rng ^= chip8->rng << 5;
+            chip8->data_registers[instr->X] = (chip8->rng >> 24) & instr->NN;
+            break;
+        case 0x0D: ;// DXYN (Display: draw a sprite N rows high from memory location I at coordinate (VX, VY), DXY0 draws a 16 x 16 sprite)
+            // the starting coordinates wrap around the screen, the sprite itself is clipped at the edges (XO-CHIP: wraps too).
+            // XO-CHIP: every selected plane gets its own sprite, stored one after the other from I
+            if (QUIRK_DISPLAY_WAIT){ // COSMAC VIP: drawing waits for the vertical blank, one sprite per frame
+                if (!chip8->vblank){
+                    chip8->PC -= 2; // execute DXYN again until tick_timers() signals the next frame
+                    break;
+                }
+                chip8->vblank = false;
+            }
+            unsigned int width = display_width(chip8), height = display_height(chip8);
+            unsigned int x = chip8->data_registers[instr->X] & (width - 1);
+            unsigned int y = chip8->data_registers[instr->Y] & (height - 1);
+            unsigned int rows = instr->N ? instr->N : 16;
+            unsigned int sprite_bytes = (instr->N ? rows : 2 * rows) * ((chip8->planes & 1) + (chip8->planes >> 1));
+            check_memory(chip8, sprite_bytes);
+            const uint8_t *sprite = &chip8->ram[chip8->I];
+            bool collision = false;
+
+            for (int plane = 0; plane < DISPLAY_PLANES; plane++)
+            {
+                if (!(chip8->planes & (1 << plane))){
+                    continue;
+                }
+                for (unsigned int i = 0; i < rows && (QUIRK_WRAP_SPRITES || y + i < height); i++)
+                {
+                    // left align the sprite row in a word, then split it over the two words of the display row.
+                    // What runs off the right edge is the part shifted past the last word
+                    uint64_t bits = instr->N ? (uint64_t)sprite[i] << 56
+                                             : (uint64_t)(sprite[2 * i] << 8 | sprite[2 * i + 1]) << 48;
+                    uint64_t left = x < 64 ? bits >> x : (QUIRK_WRAP_SPRITES && x > 64 ? bits << (128 - x) : 0);
+                    uint64_t right = x == 0 ? 0 : (x < 64 ? bits << (64 - x) : bits >> (x - 64));
+                    if (!chip8->hires){
+                        if (QUIRK_WRAP_SPRITES){
+                            left |= right; // back in at x 0
+                        }
+                        right = 0; // clipped at x 63
+                    }
+                    uint64_t *row = chip8->display[plane][(y + i) & (height - 1)];
+                    collision |= ((row[0] & left) | (row[1] & right)) != 0; // a lit pixel is turned off
+                    row[0] ^= left;
+                    row[1] ^= right;
+                }
+                sprite += instr->N ? rows : 2 * rows;
+            }
+            chip8->data_registers[0xF] = collision;
+            chip8->display_dirty = true;
+            break;
+        case 0x0E:
+            switch (instr->NN)
+            {
+            case 0x9E: // EX9E (Skip one instruction if key corresponding to value VX is pressed)
+                chip8->keys_polled = true;
+                chip8->keys_observed |= chip8->keys & (1u << (chip8->data_registers[instr->X] & 0xF));
+                if ((chip8->keys >> (chip8->data_registers[instr->X] & 0xF)) & 1){
+                    skip_instruction(chip8);
+                }
+                break;
+            case 0xA1: // EXA1 (Skip one instruction if key corresponding to value VX is not pressed)
+                chip8->keys_polled = true;
+                chip8->keys_observed |= chip8->keys & (1u << (chip8->data_registers[instr->X] & 0xF));
+                if (!((chip8->keys >> (chip8->data_registers[instr->X] & 0xF)) & 1)){
+                    skip_instruction(chip8);
+                }
+                break;
+            default:
+                break;
+            }
+            break;
+        case 0x0F:
+        switch (instr->NN)
+        {
+            case 0x00: // F000 NNNN (XO-CHIP: I is set to the 16-bit address in the next word)
+                if (instr->X == 0){
+                    chip8->I = chip8->ram[chip8->PC] << 8 | chip8->ram[(chip8->PC + 1) & 0xFFFF];
+                    chip8->PC += 2;
+                }
+                break;
+            case 0x01: // FN01 (XO-CHIP: select the planes in N for drawing, clearing and scrolling)
+                chip8->planes = instr->X & ((1 << DISPLAY_PLANES) - 1);
+                break;
+            case 0x02: // F002 (XO-CHIP: load the 16 byte audio pattern from address I)
+                if (instr->X == 0){
+                    check_memory(chip8, sizeof(chip8->audio_pattern));
+                    memcpy(chip8->audio_pattern, &chip8->ram[chip8->I], sizeof(chip8->audio_pattern));
+                    chip8->audio_pattern_set = true;
+                }
+                break;
+            case 0x3A: // FX3A (XO-CHIP: set the audio pattern playback pitch to VX)
+                chip8->pitch = chip8->data_registers[instr->X];
+                break;
+            case 0x07: // FX07 (set VX to the current value of the delay timer)
+                chip8->data_registers[instr->X] = chip8->delay_timer;
+                break;
+            case 0x15: // FX07 (set delay timer to the current value of the VX)
+                chip8->delay_timer = chip8->data_registers[instr->X];
+                break;
+            case 0x18: // FX07 (set sound timer to the current value of the VX)
+                chip8->sound_timer = chip8->data_registers[instr->X];
+                break;
+            case 0x1E: // FX1E (Add the value of VX to index register I)
+                chip8->I += chip8->data_registers[instr->X]; // in the original COSMAC VIP, VF was not set even if there was overflow here
+                break;
+            case 0x0A: ;// FX0A (Stop executing instructions and wait until key input is received)
+                // like the COSMAC VIP, a key counts once it has been pressed and released again
+                chip8->keys_latched |= chip8->keys;
+                chip8->keys_polled = true;
+                uint16_t released = chip8->keys_latched & ~chip8->keys;
+                if (!released){
+                    chip8->PC -= 2; // nothing released yet, execute FX0A again
+                }
+                else{ // store the lowest released key in VX
+                    uint8_t key = 0;
+                    while (!((released >> key) & 1)){
+                        key++;
+                    }
+                    chip8->data_registers[instr->X] = key;
+                    chip8->keys_latched = 0;
+                    chip8->keys_observed |= 1u << key;
+                }
+                break;
+            case 0x29: // FX29 (I is set to the address of the hexadecimal character in VX)
+                chip8->I = (chip8->data_registers[instr->X] & 0xF) * 5; // * 5 because one font sprite occupies 5 bytes of RAM
+                break;
+            case 0x30: // FX30 (SUPER-CHIP: I is set to the address of the 8 x 10 character in VX)
+                chip8->I = BIG_FONT_LOCATION + (chip8->data_registers[instr->X] & 0xF) * 10;
+                break;
+            case 0x33: ;// FX33 (Take number in VX and convert to threed separate decimal digits and store them in ram at address I, I + 1, and I + 2, respectively)
+                check_memory(chip8, 3);
+                uint8_t n1,n2,n3;
+                n1 = chip8->data_registers[instr->X] / 100 % 10;
+                n2 = chip8->data_registers[instr->X] / 10 % 10;
+                n3 = chip8->data_registers[instr->X] % 10;
+                chip8->ram[chip8->I] = n1; chip8->ram[chip8->I + 1] = n2; chip8->ram[chip8->I + 2] = n3;
+                mark_memory_written(chip8, 3);
+                break;
+            case 0x55: // FX55 (Store V0...VX at address I...I+X, respectively)
+                check_memory(chip8, instr->X + 1);
+                for (int i = 0; i <= instr->X; i++)
+                {
+                    chip8->ram[chip8->I + i] = chip8->data_registers[i];
+                }
+                mark_memory_written(chip8, instr->X + 1);
+                if (QUIRK_MEMORY_INCREMENT_I){ // COSMAC VIP and XO-CHIP leave I past the last register, SUPER-CHIP doesn't touch it
+                    chip8->I += instr->X + 1;
+                }
+                break;
+            case 0x65: // FX65 (Load into V0...VX the values at address I...I+X, respectively)
+                check_memory(chip8, instr->X + 1);
+                for (int i = 0; i <= instr->X; i++)
+                {
+                     chip8->data_registers[i] = chip8->ram[chip8->I + i];
+                }
+                if (QUIRK_MEMORY_INCREMENT_I){
+                    chip8->I += instr->X + 1;
+                }
+                break;
+
+            case 0x75: // FX75 (SUPER-CHIP: store V0...VX in the RPL user flags)
+                memcpy(chip8->rpl_flags, chip8->data_registers, instr->X + 1);
+                break;
+            case 0x85: // FX85 (SUPER-CHIP: load V0...VX from the RPL user flags)
+                memcpy(chip8->data_registers, chip8->rpl_flags, instr->X + 1);
+                break;
+
+            default:
+                break;
+            }
+            break;
+        default:
+            break; // unimplemented/invalid opcode
+    }
+}
+
+// execute one 60Hz frame worth of instructions, then tick the timers
+static void INTERPRETER(run_frame)(chip8_machine *chip8, instruction *instr, unsigned int instructions)
+{
+    for (unsigned int i = 0; i < instructions; i++)
+    {
+        INTERPRETER(execute)(chip8, instr);
+    }
+    tick_timers(chip8);
+}
+
+// execute up to instructions instructions, stopping after one that changes what the beeper plays
+// (FX18, FX3A, F002), return how many ran
+static unsigned int INTERPRETER(run_until_sound)(chip8_machine *chip8, instruction *instr, unsigned int instructions)
+{
+    for (unsigned int i = 0; i < instructions; i++)
+    {
+        INTERPRETER(execute)(chip8, instr);
+        uint16_t opcode = instr->opcode;
+        if ((opcode & 0xF0FF) == 0xF018 || (opcode & 0xF0FF) == 0xF03A || opcode == 0xF002)
+        {
+            return i + 1;
+        }
+    }
+    return instructions;
+}
+
+#undef INTERPRETER
+#undef QUIRK_VF_RESET
+#undef QUIRK_MEMORY_INCREMENT_I
+#undef QUIRK_SHIFT_USES_VY
+#undef QUIRK_JUMP_VX
+#undef QUIRK_WRAP_SPRITES
+#undef QUIRK_DISPLAY_WAIT
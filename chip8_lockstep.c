@@ -0,0 +1,558 @@
+// Lockstep execution, see chip8_lockstep.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_lockstep.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LANE_ISA "avx2"
+#define LANE_VECTOR_BYTES 32
+typedef __m256i lane_vector;
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LANE_ISA "sse2"
+#define LANE_VECTOR_BYTES 16
+typedef __m128i lane_vector;
+#else
+#define LANE_ISA "scalar"
+#define LANE_VECTOR_BYTES 1
+typedef uint8_t lane_vector;
+#endif
+
+#define LANE_VECTORS (LOCKSTEP_LANES / LANE_VECTOR_BYTES)
+
+// The registers of a block, register by register. Rows are aligned for vector loads. Lanes past the
+// end of the last block hold copies of lane 0 and are never written back.
+typedef struct {
+    _Alignas(32) uint8_t V[16][LOCKSTEP_LANES];
+    _Alignas(32) uint8_t delay_timer[LOCKSTEP_LANES];
+    _Alignas(32) uint8_t sound_timer[LOCKSTEP_LANES];
+    uint16_t I[LOCKSTEP_LANES];
+    uint16_t PC[LOCKSTEP_LANES];
+} lane_registers;
+
+// The quirks the vector path needs, the same as the QUIRK_ definitions in chip8_core.c
+static const struct {
+    bool vf_reset;
+    bool shift_uses_vy;
+    bool display_wait;
+} lane_quirks[PROFILE_COUNT] = {
+    [PROFILE_CHIP8] = {true, true, true},
+    [PROFILE_SCHIP] = {false, false, false},
+    [PROFILE_XOCHIP] = {false, true, false},
+};
+
+const char *lockstep_isa(void)
+{
+    return LANE_ISA;
+}
+
+// lane vector operations on LANE_VECTOR_BYTES lanes of 8-bit registers. Flags are 0 or 1 per lane
+#if defined(__AVX2__)
+static inline lane_vector lane_load(const uint8_t *lanes) { return _mm256_load_si256((const __m256i *)lanes); }
+static inline void lane_store(uint8_t *lanes, lane_vector v) { _mm256_store_si256((__m256i *)lanes, v); }
+static inline lane_vector lane_splat(uint8_t value) { return _mm256_set1_epi8((char)value); }
+static inline lane_vector lane_add(lane_vector a, lane_vector b) { return _mm256_add_epi8(a, b); }
+static inline lane_vector lane_sub(lane_vector a, lane_vector b) { return _mm256_sub_epi8(a, b); }
+static inline lane_vector lane_or(lane_vector a, lane_vector b) { return _mm256_or_si256(a, b); }
+static inline lane_vector lane_and(lane_vector a, lane_vector b) { return _mm256_and_si256(a, b); }
+static inline lane_vector lane_xor(lane_vector a, lane_vector b) { return _mm256_xor_si256(a, b); }
+static inline lane_vector lane_ge(lane_vector a, lane_vector b) // a >= b, unsigned
+{
+    return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), _mm256_set1_epi8(1));
+}
+static inline lane_vector lane_shift_right(lane_vector a, int bits)
+{
+    return _mm256_and_si256(_mm256_srli_epi16(a, bits), _mm256_set1_epi8((char)(0xFF >> bits)));
+}
+static inline lane_vector lane_tick(lane_vector timer) { return _mm256_subs_epu8(timer, _mm256_set1_epi8(1)); }
+static inline uint32_t lane_equal_mask(lane_vector a, lane_vector b) // bit L set where lane L is equal
+{
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+}
+#elif defined(__SSE2__)
+static inline lane_vector lane_load(const uint8_t *lanes) { return _mm_load_si128((const __m128i *)lanes); }
+static inline void lane_store(uint8_t *lanes, lane_vector v) { _mm_store_si128((__m128i *)lanes, v); }
+static inline lane_vector lane_splat(uint8_t value) { return _mm_set1_epi8((char)value); }
+static inline lane_vector lane_add(lane_vector a, lane_vector b) { return _mm_add_epi8(a, b); }
+static inline lane_vector lane_sub(lane_vector a, lane_vector b) { return _mm_sub_epi8(a, b); }
+static inline lane_vector lane_or(lane_vector a, lane_vector b) { return _mm_or_si128(a, b); }
+static inline lane_vector lane_and(lane_vector a, lane_vector b) { return _mm_and_si128(a, b); }
+static inline lane_vector lane_xor(lane_vector a, lane_vector b) { return _mm_xor_si128(a, b); }
+static inline lane_vector lane_ge(lane_vector a, lane_vector b)
+{
+    return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(a, b), a), _mm_set1_epi8(1));
+}
+static inline lane_vector lane_shift_right(lane_vector a, int bits)
+{
+    return _mm_and_si128(_mm_srli_epi16(a, bits), _mm_set1_epi8((char)(0xFF >> bits)));
+}
+static inline lane_vector lane_tick(lane_vector timer) { return _mm_subs_epu8(timer, _mm_set1_epi8(1)); }
+static inline uint32_t lane_equal_mask(lane_vector a, lane_vector b)
+{
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+}
+#else
+static inline lane_vector lane_load(const uint8_t *lanes) { return *lanes; }
+static inline void lane_store(uint8_t *lanes, lane_vector v) { *lanes = v; }
+static inline lane_vector lane_splat(uint8_t value) { return value; }
+static inline lane_vector lane_add(lane_vector a, lane_vector b) { return (uint8_t)(a + b); }
+static inline lane_vector lane_sub(lane_vector a, lane_vector b) { return (uint8_t)(a - b); }
+static inline lane_vector lane_or(lane_vector a, lane_vector b) { return a | b; }
+static inline lane_vector lane_and(lane_vector a, lane_vector b) { return a & b; }
+static inline lane_vector lane_xor(lane_vector a, lane_vector b) { return a ^ b; }
+static inline lane_vector lane_ge(lane_vector a, lane_vector b) { return a >= b; }
+static inline lane_vector lane_shift_right(lane_vector a, int bits) { return (uint8_t)(a >> bits); }
+static inline lane_vector lane_tick(lane_vector timer) { return timer ? timer - 1 : 0; }
+static inline uint32_t lane_equal_mask(lane_vector a, lane_vector b) { return a == b; }
+#endif
+
+static void scatter_lane(const lane_registers *regs, chip8_machine *chip8, unsigned int l)
+{
+    for (int r = 0; r < 16; r++)
+    {
+        chip8->data_registers[r] = regs->V[r][l];
+    }
+    chip8->I = regs->I[l];
+    chip8->PC = regs->PC[l];
+    chip8->delay_timer = regs->delay_timer[l];
+    chip8->sound_timer = regs->sound_timer[l];
+}
+
+static void load_lane(lane_registers *regs, const chip8_machine *chip8, unsigned int l)
+{
+    for (int r = 0; r < 16; r++)
+    {
+        regs->V[r][l] = chip8->data_registers[r];
+    }
+    regs->I[l] = chip8->I;
+    regs->PC[l] = chip8->PC;
+    regs->delay_timer[l] = chip8->delay_timer;
+    regs->sound_timer[l] = chip8->sound_timer;
+}
+
+// copy the registers of machines into lanes, filling the unused lanes from lane 0
+static void gather_lanes(lane_registers *regs, chip8_machine *const *machines, unsigned int lanes)
+{
+    for (unsigned int l = 0; l < LOCKSTEP_LANES; l++)
+    {
+        load_lane(regs, machines[l < lanes ? l : 0], l);
+    }
+}
+
+static bool same_pc(const lane_registers *regs, unsigned int lanes)
+{
+    for (unsigned int l = 1; l < lanes; l++)
+    {
+        if (regs->PC[l] != regs->PC[0])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// bit L set where VX of lane L equals other (all lanes, the unused ones too)
+static uint32_t equal_lanes(const lane_registers *regs, unsigned int x, const uint8_t *other)
+{
+    uint32_t mask = 0;
+    for (int v = 0; v < LANE_VECTORS; v++)
+    {
+        uint32_t part = lane_equal_mask(lane_load(&regs->V[x][v * LANE_VECTOR_BYTES]), lane_load(&other[v * LANE_VECTOR_BYTES]));
+        mask |= part << (v * LANE_VECTOR_BYTES);
+    }
+    return mask;
+}
+
+// bit L set where VX of lane L is value
+static uint32_t equal_value(const lane_registers *regs, unsigned int x, uint8_t value)
+{
+    uint32_t mask = 0;
+    for (int v = 0; v < LANE_VECTORS; v++)
+    {
+        uint32_t part = lane_equal_mask(lane_load(&regs->V[x][v * LANE_VECTOR_BYTES]), lane_splat(value));
+        mask |= part << (v * LANE_VECTOR_BYTES);
+    }
+    return mask;
+}
+
+// skip the next instruction in the lanes of mask, per lane since it may be F000 NNNN in some
+static void skip_lanes(lane_registers *regs, chip8_machine *const *machines, unsigned int lanes, uint32_t mask)
+{
+    for (unsigned int l = 0; mask && l < lanes; l++)
+    {
+        if ((mask >> l) & 1)
+        {
+            const uint8_t *ram = machines[l]->ram;
+            uint16_t pc = regs->PC[l];
+            regs->PC[l] += ram[pc] == 0xF0 && ram[(pc + 1) & 0xFFFF] == 0x00 ? 4 : 2;
+        }
+    }
+}
+
+// V registers an instruction that runs lane by lane may read or write, only these are copied to and
+// from the machines. None of those instructions use the timers
+static uint16_t registers_used(uint16_t opcode)
+{
+    unsigned int x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF;
+    switch (opcode >> 12)
+    {
+    case 0x0: // 00E0, 00EE, scrolling, 00FD, ...
+    case 0x2: // 2NNN
+        return 0;
+    case 0x5: ;// 5XY2 and 5XY3, VX to VY in either direction
+        unsigned int low = x < y ? x : y, high = x < y ? y : x;
+        return (uint16_t)(((2u << high) - 1) & ~((1u << low) - 1));
+    case 0xB: // BNNN, SUPER-CHIP BXNN
+        return (uint16_t)(1u | 1u << x);
+    case 0xC: // CXNN
+        return (uint16_t)(1u << x);
+    case 0xD: // DXYN
+        return (uint16_t)(1u << x | 1u << y | 1u << 0xF);
+    case 0xF:
+        switch (opcode & 0xFF)
+        {
+        case 0x55: // FX55, FX65, FX75, FX85: V0 to VX
+        case 0x65:
+        case 0x75:
+        case 0x85:
+            return (uint16_t)((2u << x) - 1);
+        default: // FX0A, FX33, FX3A, F000 NNNN, ...
+            return (uint16_t)(1u << x);
+        }
+    default:
+        return 0xFFFF;
+    }
+}
+
+// run the instruction at the (shared) PC lane by lane in the machines' own interpreters
+static void execute_lanes(lane_registers *regs, chip8_machine *const *machines, unsigned int lanes, uint16_t opcode)
+{
+    instruction instr;
+    uint16_t used = registers_used(opcode);
+    for (unsigned int l = 0; l < lanes; l++)
+    {
+        chip8_machine *chip8 = machines[l];
+        for (uint16_t r = 0, mask = used; mask; r++, mask >>= 1)
+        {
+            if (mask & 1)
+            {
+                chip8->data_registers[r] = regs->V[r][l];
+            }
+        }
+        chip8->I = regs->I[l];
+        chip8->PC = regs->PC[l];
+        execute_instruction(chip8, &instr);
+        for (uint16_t r = 0, mask = used; mask; r++, mask >>= 1)
+        {
+            if (mask & 1)
+            {
+                regs->V[r][l] = chip8->data_registers[r];
+            }
+        }
+        regs->I[l] = chip8->I;
+        regs->PC[l] = chip8->PC;
+    }
+}
+
+// execute VX op= VY style instructions over all lanes, dst = op(VX, VY), VF written last
+static void alu_lanes(lane_registers *regs, quirk_profile profile, unsigned int x, unsigned int y, unsigned int n)
+{
+    for (int v = 0; v < LANE_VECTORS; v++)
+    {
+        unsigned int offset = v * LANE_VECTOR_BYTES;
+        lane_vector vx = lane_load(&regs->V[x][offset]);
+        lane_vector vy = lane_load(&regs->V[y][offset]);
+        lane_vector shifted = lane_quirks[profile].shift_uses_vy ? vy : vx;
+        lane_vector result, flag;
+        bool sets_flag = true;
+        switch (n)
+        {
+        case 0x0:
+            result = vy;
+            flag = vy;
+            sets_flag = false;
+            break;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+            result = n == 1 ? lane_or(vx, vy) : (n == 2 ? lane_and(vx, vy) : lane_xor(vx, vy));
+            flag = lane_splat(0);
+            sets_flag = lane_quirks[profile].vf_reset;
+            break;
+        case 0x4:
+            result = lane_add(vx, vy);
+            flag = lane_xor(lane_ge(result, vx), lane_splat(1)); // carry: the sum wrapped below VX
+            break;
+        case 0x5:
+            result = lane_sub(vx, vy);
+            flag = lane_ge(vx, vy);
+            break;
+        case 0x6:
+            result = lane_shift_right(shifted, 1);
+            flag = lane_and(shifted, lane_splat(1));
+            break;
+        case 0x7:
+            result = lane_sub(vy, vx);
+            flag = lane_ge(vy, vx);
+            break;
+        default: // 0xE
+            result = lane_add(shifted, shifted);
+            flag = lane_shift_right(shifted, 7);
+            break;
+        }
+        lane_store(&regs->V[x][offset], result);
+        if (sets_flag)
+        {
+            lane_store(&regs->V[0xF][offset], flag);
+        }
+    }
+}
+
+// Execute up to instructions instructions of a block whose lanes share their PC and profile, for as
+// long as they keep doing so. Returns how many were executed, the rest is up to the caller, adds how
+// many of them ran lane by lane to *lane_by_lane and sets *waiting to how many were DXYN waiting for
+// vblank in every lane, which did nothing.
+static unsigned int run_lanes(lane_registers *regs, chip8_machine *const *machines, unsigned int lanes,
+                              unsigned int instructions, unsigned int *lane_by_lane, unsigned int *waiting)
+{
+    quirk_profile profile = (quirk_profile)machines[0]->profile;
+    uint32_t active = lanes == 32 ? 0xFFFFFFFFu : (1u << lanes) - 1;
+    for (unsigned int i = 0; i < instructions; i++)
+    {
+        // the lanes may still hold different code at the same address, after writing RAM differently
+        uint16_t pc = regs->PC[0];
+        const uint8_t *code = machines[0]->ram;
+        if (pc == 0xFFFF)
+        {
+            return i; // wraps around RAM, left to the interpreter
+        }
+        uint16_t word, lane_word;
+        memcpy(&word, &code[pc], sizeof(word));
+        for (unsigned int l = 1; l < lanes; l++)
+        {
+            memcpy(&lane_word, &machines[l]->ram[pc], sizeof(lane_word));
+            if (lane_word != word)
+            {
+                return i;
+            }
+        }
+        uint16_t opcode = code[pc] << 8 | code[pc + 1];
+        unsigned int x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF, n = opcode & 0xF;
+        uint8_t nn = opcode & 0xFF;
+        uint16_t nnn = opcode & 0xFFF;
+        uint16_t next = pc + 2;
+
+        bool vector = true;
+        uint32_t skip = 0; // lanes that skip the next instruction
+        switch (opcode >> 12)
+        {
+        case 0x1: // 1NNN
+            next = nnn;
+            break;
+        case 0x3: // 3XNN
+        case 0x4: // 4XNN
+            skip = equal_value(regs, x, nn);
+            skip = (opcode >> 12) == 0x3 ? skip : ~skip;
+            break;
+        case 0x5: // 5XY0, 5XY2 and 5XY3 write and read RAM
+            if (n != 0)
+            {
+                vector = n != 2 && n != 3;
+                break;
+            }
+            skip = equal_lanes(regs, x, regs->V[y]);
+            break;
+        case 0x9: // 9XY0
+            skip = ~equal_lanes(regs, x, regs->V[y]);
+            break;
+        case 0x6: // 6XNN
+            memset(regs->V[x], nn, LOCKSTEP_LANES);
+            break;
+        case 0x7: // 7XNN
+            for (int v = 0; v < LANE_VECTORS; v++)
+            {
+                uint8_t *row = &regs->V[x][v * LANE_VECTOR_BYTES];
+                lane_store(row, lane_add(lane_load(row), lane_splat(nn)));
+            }
+            break;
+        case 0x8:
+            if (n <= 0x7 || n == 0xE)
+            {
+                alu_lanes(regs, profile, x, y, n);
+            }
+            break;
+        case 0xA: // ANNN
+            for (unsigned int l = 0; l < LOCKSTEP_LANES; l++)
+            {
+                regs->I[l] = nnn;
+            }
+            break;
+        case 0xE: // EX9E and EXA1, the keys are the machines' own
+            if (nn == 0x9E || nn == 0xA1)
+            {
+                for (unsigned int l = 0; l < lanes; l++)
+                {
+                    chip8_machine *chip8 = machines[l];
+                    uint16_t key = 1u << (regs->V[x][l] & 0xF);
+                    chip8->keys_polled = true;
+                    chip8->keys_observed |= chip8->keys & key;
+                    skip |= (uint32_t)(((chip8->keys & key) != 0) == (nn == 0x9E)) << l;
+                }
+            }
+            break;
+        case 0xF:
+            switch (nn)
+            {
+            case 0x07: // FX07
+                memcpy(regs->V[x], regs->delay_timer, LOCKSTEP_LANES);
+                break;
+            case 0x15: // FX15
+                memcpy(regs->delay_timer, regs->V[x], LOCKSTEP_LANES);
+                break;
+            case 0x18: // FX18
+                memcpy(regs->sound_timer, regs->V[x], LOCKSTEP_LANES);
+                break;
+            case 0x1E: // FX1E
+                for (unsigned int l = 0; l < LOCKSTEP_LANES; l++)
+                {
+                    regs->I[l] += regs->V[x][l];
+                }
+                break;
+            case 0x29: // FX29
+                for (unsigned int l = 0; l < LOCKSTEP_LANES; l++)
+                {
+                    regs->I[l] = (regs->V[x][l] & 0xF) * 5;
+                }
+                break;
+            case 0x30: // FX30
+                for (unsigned int l = 0; l < LOCKSTEP_LANES; l++)
+                {
+                    regs->I[l] = BIG_FONT_LOCATION + (regs->V[x][l] & 0xF) * 10;
+                }
+                break;
+            default:
+                vector = false;
+                break;
+            }
+            break;
+        case 0xD: // DXYN
+            if (lane_quirks[profile].display_wait)
+            {
+                bool vblank = false;
+                for (unsigned int l = 0; l < lanes; l++)
+                {
+                    vblank |= machines[l]->vblank;
+                }
+                if (!vblank)
+                {
+                    *waiting = instructions - i;
+                    return instructions; // every lane executes DXYN again, unchanged, until the frame ends
+                }
+            }
+            vector = false;
+            break;
+        default: // the rest of the display, the stack, BNNN and CXNN
+            vector = false;
+            break;
+        }
+
+        if (!vector)
+        {
+            execute_lanes(regs, machines, lanes, opcode);
+            (*lane_by_lane)++;
+            if (!same_pc(regs, lanes))
+            {
+                return i + 1;
+            }
+            continue;
+        }
+        for (unsigned int l = 0; l < LOCKSTEP_LANES; l++)
+        {
+            regs->PC[l] = next;
+        }
+        skip &= active;
+        if (skip)
+        {
+            skip_lanes(regs, machines, lanes, skip);
+            if (skip != active || !same_pc(regs, lanes))
+            {
+                return i + 1;
+            }
+        }
+    }
+    return instructions;
+}
+
+// Run one frame of instructions instructions on every machine, then tick their timers, with the same
+// results as run_frame() on each of them. Machines i with skip[i] set are left as they are, skip may
+// be NULL for none: blocks are made of the next LOCKSTEP_LANES machines that do run, wherever the
+// skipped ones are. stats, which may be NULL, gets the instruction counts added
+void run_frame_lockstep(chip8_machine *machines, uint32_t count, unsigned int instructions, const uint8_t *skip,
+                        lockstep_stats *stats)
+{
+    instruction instr;
+    for (uint32_t next = 0; next < count;)
+    {
+        chip8_machine *block[LOCKSTEP_LANES];
+        unsigned int lanes = 0;
+        for (; next < count && lanes < LOCKSTEP_LANES; next++)
+        {
+            if (!skip || !skip[next])
+            {
+                block[lanes++] = &machines[next];
+            }
+        }
+        if (lanes == 0)
+        {
+            break;
+        }
+        lane_registers regs;
+        gather_lanes(&regs, block, lanes);
+
+        bool same_profile = true;
+        for (unsigned int l = 1; l < lanes; l++)
+        {
+            same_profile &= block[l]->profile == block[0]->profile;
+        }
+        unsigned int lane_by_lane = 0, waiting = 0;
+        unsigned int done = lanes > 1 && same_profile && same_pc(&regs, lanes)
+                                ? run_lanes(&regs, block, lanes, instructions, &lane_by_lane, &waiting) : 0;
+
+        if (done == instructions)
+        {
+            for (int v = 0; v < LANE_VECTORS; v++)
+            {
+                unsigned int offset = v * LANE_VECTOR_BYTES;
+                lane_store(&regs.delay_timer[offset], lane_tick(lane_load(&regs.delay_timer[offset])));
+                lane_store(&regs.sound_timer[offset], lane_tick(lane_load(&regs.sound_timer[offset])));
+            }
+            for (unsigned int l = 0; l < lanes; l++)
+            {
+                scatter_lane(&regs, block[l], l);
+                block[l]->vblank = true; // the rest of tick_timers()
+            }
+        }
+        else
+        {
+            // went different ways: each machine finishes the frame on its own
+            for (unsigned int l = 0; l < lanes; l++)
+            {
+                scatter_lane(&regs, block[l], l);
+                for (unsigned int i = done; i < instructions; i++)
+                {
+                    execute_instruction(block[l], &instr);
+                }
+                tick_timers(block[l]);
+            }
+        }
+        if (stats)
+        {
+            stats->vector_instructions += (uint64_t)(done - lane_by_lane - waiting) * lanes;
+            stats->scalar_instructions += (uint64_t)(instructions - done + lane_by_lane) * lanes;
+        }
+    }
+}
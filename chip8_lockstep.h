@@ -0,0 +1,30 @@
+// Lockstep execution of many machines running the same ROM, part of libchip8. Machines are taken
+// LOCKSTEP_LANES at a time. While the machines of such a block are at the same PC, every instruction
+// is fetched and decoded once for the whole block, with their registers laid out lane by lane
+// (structure of arrays) so the arithmetic, loads, skips and timers are SIMD operations over all the
+// lanes: AVX2 when the library is built with it (-mavx2 or -march=native), SSE2 otherwise on x86-64,
+// plain C elsewhere. Instructions that touch per-machine memory (DXYN, the stack, FX33/FX55/FX65, ...)
+// run lane by lane through the normal interpreter. A block whose machines went different ways runs
+// lane by lane for the rest of the frame and is tried again the next frame.
+//
+// The results are exactly those of run_frame() on every machine, lockstep only changes the speed.
+#ifndef CHIP8_LOCKSTEP_H
+#define CHIP8_LOCKSTEP_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define LOCKSTEP_LANES 32 // machines in a block, one AVX2 register of 8-bit registers
+
+// DXYN waiting for vblank in a whole block counts as neither, nothing is executed
+typedef struct {
+    uint64_t vector_instructions; // machine instructions executed once for a whole block
+    uint64_t scalar_instructions; // machine instructions executed lane by lane
+} lockstep_stats;
+
+void run_frame_lockstep(chip8_machine *machines, uint32_t count, unsigned int instructions, const uint8_t *skip,
+                        lockstep_stats *stats);
+const char *lockstep_isa(void);
+
+#endif // CHIP8_LOCKSTEP_H
@@ -0,0 +1,118 @@
+// Memory mapped files, see chip8_mmap.h
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L // mmap is POSIX, libchip8 is otherwise plain C11
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "chip8_mmap.h"
+
+#ifdef _WIN32
+// return success status of mapping the whole file read-only
+bool map_file(mapped_file *file, const char *path)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size))
+    {
+        CloseHandle(handle);
+        return false;
+    }
+    if (size.QuadPart == 0) // can't map an empty file, and there is nothing to map
+    {
+        CloseHandle(handle);
+        return true;
+    }
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(handle); // the mapping keeps the file open
+    if (!mapping)
+    {
+        return false;
+    }
+    const void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+    file->data = data;
+    file->size = (size_t)size.QuadPart;
+    file->mapping = mapping;
+    return true;
+}
+
+void unmap_file(mapped_file *file)
+{
+    if (file->data)
+    {
+        UnmapViewOfFile(file->data);
+        CloseHandle(file->mapping);
+    }
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+}
+#else
+// return success status of mapping the whole file read-only
+bool map_file(mapped_file *file, const char *path)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) // mmap rejects a zero length, and there is nothing to map
+    {
+        close(fd);
+        return true;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    return true;
+}
+
+void unmap_file(mapped_file *file)
+{
+    if (file->data)
+    {
+        munmap((void *)file->data, file->size);
+    }
+    file->data = NULL;
+    file->size = 0;
+}
+#endif
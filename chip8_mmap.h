@@ -0,0 +1,19 @@
+// Read-only memory mapped files (POSIX mmap, CreateFileMapping on Windows), part of libchip8. Used
+// for the ROM database, which is looked up in place instead of being read and parsed.
+#ifndef CHIP8_MMAP_H
+#define CHIP8_MMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    const uint8_t *data; // the file contents, NULL for an empty file
+    size_t size;
+    void *mapping; // Windows file mapping handle, unused elsewhere
+} mapped_file;
+
+bool map_file(mapped_file *file, const char *path);
+void unmap_file(mapped_file *file);
+
+#endif // CHIP8_MMAP_H
@@ -0,0 +1,225 @@
+// Input movie recording and playback, see chip8_movie.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+#include "chip8_movie.h"
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_HEADER_SIZE 28
+#define MOVIE_FRAMES_OFFSET 24 // where close_movie() patches in the frame count
+
+static void put_le(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// flush the current run as u16 keys + LEB128 frame count
+static void write_run(movie *mv)
+{
+    if (mv->run == 0)
+    {
+        return;
+    }
+    uint8_t out[2 + 5];
+    int size = 2;
+    put_le(out, mv->keys, 2);
+    uint32_t count = mv->run;
+    do
+    {
+        out[size++] = (count & 0x7F) | (count >= 0x80 ? 0x80 : 0);
+        count >>= 7;
+    } while (count);
+    if (fwrite(out, size, 1, mv->file) != 1)
+    {
+        mv->failed = true;
+    }
+    mv->run = 0;
+}
+
+// load the next run, returns false at the end of the movie
+static bool read_run(movie *mv)
+{
+    uint8_t keys[2];
+    if (fread(keys, sizeof(keys), 1, mv->file) != 1)
+    {
+        return false;
+    }
+    uint32_t count = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        int byte = fgetc(mv->file);
+        if (byte == EOF)
+        {
+            mv->failed = true;
+            return false;
+        }
+        count |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+    }
+    if (count == 0)
+    {
+        mv->failed = true;
+        return false;
+    }
+    mv->keys = (uint16_t)get_le(keys, 2);
+    mv->run = count;
+    return true;
+}
+
+// return success status of creating the file, frames are added with record_movie_frame()
+bool create_movie(movie *mv, const char *path, const movie_header *header)
+{
+    mv->file = fopen(path, "wb");
+    if (!mv->file)
+    {
+        fprintf(stderr, "Could not create %s\n", path);
+        return false;
+    }
+    mv->header = *header;
+    mv->header.frames = 0;
+    mv->recording = true;
+    mv->failed = false;
+    mv->keys = 0;
+    mv->run = 0;
+    mv->frame = 0;
+
+    uint8_t out[MOVIE_HEADER_SIZE] = MOVIE_MAGIC;
+    put_le(&out[4], MOVIE_VERSION, 2);
+    put_le(&out[6], header->instructions_per_frame, 2);
+    put_le(&out[8], header->frame_rate, 2);
+    put_le(&out[10], header->profile, 2);
+    put_le(&out[12], header->seed, 4);
+    put_le(&out[16], header->rom_hash, 8);
+    if (fwrite(out, sizeof(out), 1, mv->file) != 1)
+    {
+        mv->failed = true;
+    }
+    return true;
+}
+
+// append the key state of one frame
+void record_movie_frame(movie *mv, uint16_t keys)
+{
+    if (keys != mv->keys || mv->run == UINT32_MAX)
+    {
+        write_run(mv);
+        mv->keys = keys;
+    }
+    mv->run++;
+    mv->frame++;
+}
+
+// return success status of opening a movie for playback, its settings are in mv->header
+bool open_movie(movie *mv, const char *path)
+{
+    mv->file = fopen(path, "rb");
+    if (!mv->file)
+    {
+        fprintf(stderr, "Could not find file %s\n", path);
+        return false;
+    }
+    uint8_t in[MOVIE_HEADER_SIZE];
+    if (fread(in, sizeof(in), 1, mv->file) != 1 || get_le(in, 4) != get_le((const uint8_t *)MOVIE_MAGIC, 4)
+        || get_le(&in[4], 2) != MOVIE_VERSION)
+    {
+        fprintf(stderr, "%s is not a version %d movie\n", path, MOVIE_VERSION);
+        fclose(mv->file);
+        mv->file = NULL;
+        return false;
+    }
+    mv->header.instructions_per_frame = (uint16_t)get_le(&in[6], 2);
+    mv->header.frame_rate = (uint16_t)get_le(&in[8], 2);
+    mv->header.profile = (uint16_t)get_le(&in[10], 2);
+    mv->header.seed = (uint32_t)get_le(&in[12], 4);
+    mv->header.rom_hash = get_le(&in[16], 8);
+    mv->header.frames = (uint32_t)get_le(&in[MOVIE_FRAMES_OFFSET], 4);
+    mv->recording = false;
+    mv->failed = false;
+    mv->keys = 0;
+    mv->run = 0;
+    mv->frame = 0;
+    return true;
+}
+
+// return success status of checking the movie was recorded on the ROM loaded in chip8, and seeding
+// the machine and setting its profile like the recording was. The caller runs instructions_per_frame instructions per frame
+bool start_movie(const movie *mv, chip8_machine *chip8)
+{
+    if (mv->header.rom_hash != chip8->rom_hash)
+    {
+        fprintf(stderr, "Movie was recorded with a different ROM\n");
+        return false;
+    }
+    if (mv->header.frame_rate != MOVIE_FRAME_RATE || mv->header.instructions_per_frame == 0)
+    {
+        fprintf(stderr, "Movie timing (%u instructions per frame at %uHz) is not supported\n",
+                mv->header.instructions_per_frame, mv->header.frame_rate);
+        return false;
+    }
+    if (mv->header.profile >= PROFILE_COUNT)
+    {
+        fprintf(stderr, "Movie was recorded with an unknown quirk profile (%u)\n", mv->header.profile);
+        return false;
+    }
+    seed_chip8(chip8, mv->header.seed);
+    chip8->profile = (uint8_t)mv->header.profile;
+    return true;
+}
+
+// get the key state of the next frame, returns false once every recorded frame has been played
+bool play_movie_frame(movie *mv, uint16_t *keys)
+{
+    if (mv->frame >= mv->header.frames)
+    {
+        return false;
+    }
+    if (mv->run == 0 && !read_run(mv))
+    {
+        mv->failed = true; // the file is shorter than its header says
+        return false;
+    }
+    mv->run--;
+    mv->frame++;
+    *keys = mv->keys;
+    return true;
+}
+
+// return success status of the whole recording or playback, a recording gets its frame count here
+bool close_movie(movie *mv)
+{
+    if (mv->recording)
+    {
+        write_run(mv);
+        uint8_t frames[4];
+        put_le(frames, mv->frame, 4);
+        if (fseek(mv->file, MOVIE_FRAMES_OFFSET, SEEK_SET) != 0 || fwrite(frames, sizeof(frames), 1, mv->file) != 1)
+        {
+            mv->failed = true;
+        }
+        mv->header.frames = mv->frame;
+    }
+    if (fclose(mv->file) != 0)
+    {
+        mv->failed = true;
+    }
+    mv->file = NULL;
+    return !mv->failed;
+}
@@ -0,0 +1,46 @@
+// Input movies: the key state of every frame of a run, so it can be replayed exactly, part of libchip8.
+#ifndef CHIP8_MOVIE_H
+#define CHIP8_MOVIE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+#define MOVIE_VERSION 2 // 2: quirk profile
+#define MOVIE_FRAME_RATE 60 // timer ticks per second the movie was recorded at
+
+// Everything besides the input that decides how a run goes. Playing a movie back on a machine
+// loaded with the same ROM, seeded with seed, set to the same profile and stepped with the same
+// timing reproduces the run.
+typedef struct {
+    uint64_t rom_hash; // chip8_machine.rom_hash of the recorded ROM
+    uint32_t seed; // seed_chip8() value
+    uint16_t instructions_per_frame;
+    uint16_t frame_rate;
+    uint16_t profile; // quirk_profile the machine ran with
+    uint32_t frames; // frames recorded, filled in by close_movie() when recording
+} movie_header;
+
+// File layout, little endian: "C8MV", u16 version, u16 instructions per frame, u16 frame rate,
+// u16 quirk profile, u32 seed, u64 ROM hash, u32 frames, then runs of (u16 keys, LEB128 frame count).
+// Key state changes a few times a second at most, so a run costs 3 bytes for many frames.
+typedef struct {
+    FILE *file;
+    movie_header header;
+    bool recording;
+    bool failed; // a read or write failed, or the file is malformed
+    uint16_t keys; // key state of the current run
+    uint32_t run; // recording: frames in the current run, playback: frames left in it
+    uint32_t frame; // frames recorded or played so far
+} movie;
+
+bool create_movie(movie *mv, const char *path, const movie_header *header);
+void record_movie_frame(movie *mv, uint16_t keys);
+bool open_movie(movie *mv, const char *path);
+bool start_movie(const movie *mv, chip8_machine *chip8);
+bool play_movie_frame(movie *mv, uint16_t *keys);
+bool close_movie(movie *mv);
+
+#endif // CHIP8_MOVIE_H
@@ -0,0 +1,157 @@
+// ROM database, see chip8_romdb.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_mmap.h"
+#include "chip8_romdb.h"
+
+#define ROMDB_MAGIC "C8DB"
+#define ROMDB_HEADER_SIZE 16
+#define ROMDB_ENTRY_SIZE 64
+#define ROMDB_KEYMAP_OFFSET 12
+#define ROMDB_TITLE_OFFSET 28
+
+static void put_le(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// length of a string field that may fill its whole array without a terminator
+static size_t field_length(const char *field, size_t size)
+{
+    size_t length = 0;
+    while (length < size && field[length])
+    {
+        length++;
+    }
+    return length;
+}
+
+static int compare_roms(const void *a, const void *b)
+{
+    uint64_t hash_a = ((const rom_info *)a)->rom_hash, hash_b = ((const rom_info *)b)->rom_hash;
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+// return success status of writing a database of count ROMs, roms is sorted by hash in place.
+// Fails on two entries for the same ROM, the lookup could only ever find one of them
+bool write_romdb(const char *path, rom_info *roms, uint32_t count)
+{
+    qsort(roms, count, sizeof(rom_info), compare_roms);
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (roms[i].rom_hash == roms[i - 1].rom_hash)
+        {
+            fprintf(stderr, "ROM %016llX is in the database twice\n", (unsigned long long)roms[i].rom_hash);
+            return false;
+        }
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Could not create %s\n", path);
+        return false;
+    }
+    bool ok = true;
+    uint8_t header[ROMDB_HEADER_SIZE] = ROMDB_MAGIC;
+    put_le(&header[4], ROMDB_VERSION, 4);
+    put_le(&header[8], count, 4);
+    ok &= fwrite(header, sizeof(header), 1, file) == 1;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t entry[ROMDB_ENTRY_SIZE] = {0};
+        put_le(&entry[0], roms[i].rom_hash, 8);
+        entry[8] = roms[i].platform;
+        entry[9] = roms[i].profile;
+        put_le(&entry[10], roms[i].instructions_per_frame, 2);
+        memcpy(&entry[ROMDB_KEYMAP_OFFSET], roms[i].keymap, field_length(roms[i].keymap, 16));
+        memcpy(&entry[ROMDB_TITLE_OFFSET], roms[i].title, field_length(roms[i].title, ROMDB_TITLE_SIZE));
+        ok &= fwrite(entry, sizeof(entry), 1, file) == 1;
+    }
+    ok &= fclose(file) == 0;
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write %s\n", path);
+    }
+    return ok;
+}
+
+// return success status of mapping a database written by write_romdb()
+bool open_romdb(romdb *db, const char *path)
+{
+    db->entries = NULL;
+    db->count = 0;
+    if (!map_file(&db->file, path))
+    {
+        return false;
+    }
+    const uint8_t *data = db->file.data;
+    if (db->file.size < ROMDB_HEADER_SIZE || memcmp(data, ROMDB_MAGIC, 4) != 0 || get_le(&data[4], 4) != ROMDB_VERSION
+        || get_le(&data[8], 4) > (db->file.size - ROMDB_HEADER_SIZE) / ROMDB_ENTRY_SIZE)
+    {
+        fprintf(stderr, "%s is not a version %d ROM database\n", path, ROMDB_VERSION);
+        unmap_file(&db->file);
+        return false;
+    }
+    db->entries = &data[ROMDB_HEADER_SIZE];
+    db->count = (uint32_t)get_le(&data[8], 4);
+    return true;
+}
+
+// return whether the ROM with this hash is in the database, and its settings in info if so
+bool find_rom(const romdb *db, uint64_t rom_hash, rom_info *info)
+{
+    uint32_t low = 0, high = db->count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        const uint8_t *entry = &db->entries[(size_t)middle * ROMDB_ENTRY_SIZE];
+        uint64_t hash = get_le(entry, 8);
+        if (hash < rom_hash)
+        {
+            low = middle + 1;
+        }
+        else if (hash > rom_hash)
+        {
+            high = middle;
+        }
+        else
+        {
+            info->rom_hash = hash;
+            info->platform = entry[8] < PROFILE_COUNT ? entry[8] : PROFILE_CHIP8;
+            info->profile = entry[9] < PROFILE_COUNT ? entry[9] : PROFILE_CHIP8;
+            info->instructions_per_frame = (uint16_t)get_le(&entry[10], 2);
+            memcpy(info->keymap, &entry[ROMDB_KEYMAP_OFFSET], 16);
+            info->keymap[16] = '\0';
+            memcpy(info->title, &entry[ROMDB_TITLE_OFFSET], ROMDB_TITLE_SIZE);
+            info->title[ROMDB_TITLE_SIZE] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+void close_romdb(romdb *db)
+{
+    unmap_file(&db->file);
+    db->entries = NULL;
+    db->count = 0;
+}
@@ -0,0 +1,40 @@
+// Database of known ROMs, looked up by chip8_machine.rom_hash to start every ROM with the settings
+// it was written for, part of libchip8.
+#ifndef CHIP8_ROMDB_H
+#define CHIP8_ROMDB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "chip8_mmap.h"
+
+#define ROMDB_VERSION 1
+#define ROMDB_TITLE_SIZE 36 // bytes of title stored per ROM, longer titles are cut
+#define DEFAULT_ROMDB "chip8.romdb" // built from romdb.txt by make romdb
+
+typedef struct {
+    uint64_t rom_hash; // chip8_machine.rom_hash of the ROM
+    uint8_t platform; // quirk_profile of the machine the ROM targets (the opcodes it needs)
+    uint8_t profile; // quirk_profile it runs correctly with, can differ from the platform
+    uint16_t instructions_per_frame; // speed it was tuned for
+    char keymap[17]; // --keymap string for the SDL frontend, empty for the default layout
+    char title[ROMDB_TITLE_SIZE + 1];
+} rom_info;
+
+// File layout, little endian: "C8DB", u32 version, u32 count, u32 reserved, then count 64 byte
+// entries sorted by hash: u64 hash, u8 platform, u8 profile, u16 instructions per frame,
+// 16 keymap bytes, ROMDB_TITLE_SIZE title bytes (both zero padded). The file is memory mapped and
+// binary searched in place, so opening it costs the same for ten entries or a hundred thousand.
+typedef struct {
+    mapped_file file;
+    const uint8_t *entries;
+    uint32_t count;
+} romdb;
+
+bool write_romdb(const char *path, rom_info *roms, uint32_t count);
+bool open_romdb(romdb *db, const char *path);
+bool find_rom(const romdb *db, uint64_t rom_hash, rom_info *info);
+void close_romdb(romdb *db);
+
+#endif // CHIP8_ROMDB_H
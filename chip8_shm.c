@@ -0,0 +1,454 @@
+// Shared memory environments, see chip8_shm.h
+#ifdef __linux__
+#define _GNU_SOURCE // syscall(), for futexes, libchip8 is otherwise plain C11
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "chip8.h"
+#include "chip8_env.h"
+#include "chip8_shm.h"
+
+#ifdef __linux__
+#define SHM_SPINS 20000 // polls of the other side before sleeping, some tens of microseconds
+#define SHM_CLIENT_WAIT_MS 1000 // between checks that the server is still there
+
+static size_t align64(size_t size)
+{
+    return (size + 63) & ~(size_t)63;
+}
+
+// return whether *word changed from value within wait_ms: spin first, then sleep on the futex until
+// futex_wake(), the timeout or a signal. Not FUTEX_PRIVATE, the word is shared with another process
+static bool wait_change(_Atomic uint32_t *word, uint32_t value, unsigned int wait_ms)
+{
+    for (int i = 0; i < SHM_SPINS; i++)
+    {
+        if (atomic_load_explicit(word, memory_order_acquire) != value)
+        {
+            return true;
+        }
+    }
+    struct timespec timeout = {(time_t)(wait_ms / 1000), (long)(wait_ms % 1000) * 1000000};
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, &timeout, NULL, 0);
+    return atomic_load_explicit(word, memory_order_acquire) != value;
+}
+
+static void futex_wake(_Atomic uint32_t *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// the name of the region holding the machines of the region name
+static void machines_name(char *out, size_t size, const char *name)
+{
+    snprintf(out, size, "%s" SHM_MACHINES_SUFFIX, name);
+}
+
+// Create the region name with size bytes and map it, MAP_FAILED with errno set if that failed
+// (EEXIST: there is one of that name). With locked_fd, the region is locked with LOCK_EX before it
+// gets its size, so no other server takes it for one left behind, and the descriptor holding the
+// lock is stored there. Otherwise it is closed, the mapping keeps the region open
+static void *create_region(const char *name, size_t size, int *locked_fd)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        return MAP_FAILED;
+    }
+    void *region = MAP_FAILED;
+    if ((!locked_fd || flock(fd, LOCK_EX | LOCK_NB) == 0) && ftruncate(fd, (off_t)size) == 0)
+    {
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int error = errno;
+    if (region == MAP_FAILED)
+    {
+        shm_unlink(name);
+    }
+    if (region == MAP_FAILED || !locked_fd)
+    {
+        close(fd);
+    }
+    else
+    {
+        *locked_fd = fd;
+    }
+    errno = error;
+    return region;
+}
+
+// map the whole of the existing region name, writable or read only, and store its size. MAP_FAILED
+// with errno set if that failed. With fd the descriptor is kept open there, for flock()
+static void *open_region(const char *name, bool writable, size_t *size, int *fd_out)
+{
+    int fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return MAP_FAILED;
+    }
+    struct stat st;
+    void *region = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        *size = (size_t)st.st_size;
+        region = mmap(NULL, *size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    }
+    else
+    {
+        errno = EINVAL;
+    }
+    int error = errno;
+    if (region == MAP_FAILED || !fd_out)
+    {
+        close(fd);
+    }
+    else
+    {
+        *fd_out = fd;
+    }
+    errno = error;
+    return region;
+}
+
+// return whether the region name is the one open as fd, and not one created under that name since
+static bool is_named(int fd, const char *name)
+{
+    int named = shm_open(name, O_RDONLY, 0);
+    struct stat st, named_st;
+    bool same = named >= 0 && fstat(fd, &st) == 0 && fstat(named, &named_st) == 0 && st.st_dev == named_st.st_dev
+                && st.st_ino == named_st.st_ino;
+    if (named >= 0)
+    {
+        close(named);
+    }
+    return same;
+}
+
+// Remove the regions of name and machines if a server that is gone left them behind, such as one
+// that crashed: an environment server's region, of any layout or not ready yet, whose LOCK_EX is
+// free. A server holds that lock from creating the region until it ends, the kernel drops it however
+// the process ends, so neither a zombie nor a new process that got its pid keeps the regions. Return
+// whether that was the case. A region of a running server, or one that isn't an environment
+// server's, is left alone. The regions are unlinked while holding the lock, after checking that the
+// name still is the region locked: another server that removed it first and created its own under
+// the name holds that one's lock, and removes only after taking it
+static bool remove_stale(const char *name, const char *machines)
+{
+    size_t size;
+    int fd;
+    shm_header *header = open_region(name, false, &size, &fd);
+    if (header == MAP_FAILED)
+    {
+        return false;
+    }
+    static const char unset[sizeof(header->magic)];
+    bool ours = size >= sizeof(shm_header)
+                && (memcmp(header->magic, SHM_MAGIC, 5) == 0 // "C8SHM", the layout version after it
+                    || (memcmp(header->magic, unset, sizeof(unset)) == 0 && header->size == size));
+    munmap(header, size);
+    bool stale = ours && flock(fd, LOCK_EX | LOCK_NB) == 0 && is_named(fd, name);
+    if (stale)
+    {
+        shm_unlink(machines); // first, the next server creates its own once name is free
+        shm_unlink(name);
+    }
+    close(fd); // drops the lock
+    return stale;
+}
+
+// point shm at the parts of the mapped regions, as laid out by layout: the server's own, or a
+// client's checked copy of the header, never the header other processes can write to
+static void use_regions(shm_env *shm, void *region, size_t size, int fd, chip8_machine *machines,
+                        size_t machines_size, const shm_header *layout, const char *name)
+{
+    shm->header = region;
+    shm->fd = fd;
+    shm->machines = machines;
+    shm->actions = (uint16_t *)((uint8_t *)region + layout->actions_offset);
+    shm->done = (uint8_t *)region + layout->done_offset;
+    shm->rewards = (float *)((uint8_t *)region + layout->rewards_offset);
+    shm->count = layout->count;
+    shm->size = size;
+    shm->machines_size = machines_size;
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+}
+
+// return success status of creating the shared memory regions name ("/something", see shm_open()) and
+// name-machines, and count machines in them, which start their first episode like create_envs(). The
+// regions a server that is gone left behind under these names are removed first, those of a running
+// server are left alone. Errors are printed
+bool create_shm_server(shm_env *shm, chip8_envs *envs, const char *name, uint32_t count, const uint8_t *rom,
+                       size_t rom_size, const env_config *config)
+{
+    memset(shm, 0, sizeof(*shm));
+    if (name[0] != '/' || strchr(name + 1, '/') || strlen(name) + strlen(SHM_MACHINES_SUFFIX) >= sizeof(shm->name))
+    {
+        fprintf(stderr, "Shared memory names are a / and up to %zu other characters: %s\n",
+                sizeof(shm->name) - strlen(SHM_MACHINES_SUFFIX) - 2, name);
+        return false;
+    }
+    char machines[sizeof(shm->name) + sizeof(SHM_MACHINES_SUFFIX)];
+    machines_name(machines, sizeof(machines), name);
+    shm_header layout = {.count = count, .machine_size = sizeof(chip8_machine),
+                         .display_offset = offsetof(chip8_machine, display),
+                         .hires_offset = offsetof(chip8_machine, hires), .profile = config->profile,
+                         .server_pid = (uint32_t)getpid()};
+    layout.actions_offset = align64(sizeof(shm_header));
+    layout.done_offset = align64(layout.actions_offset + count * (uint64_t)sizeof(uint16_t));
+    layout.rewards_offset = align64(layout.done_offset + count);
+    layout.size = layout.rewards_offset + count * (uint64_t)sizeof(float);
+    size_t machines_size = count * sizeof(chip8_machine);
+
+    int fd;
+    void *region = create_region(name, layout.size, &fd);
+    if (region == MAP_FAILED && errno == EEXIST)
+    {
+        if (remove_stale(name, machines))
+        {
+            fprintf(stderr, "Removed %s, left behind by a server that is gone\n", name);
+            region = create_region(name, layout.size, &fd);
+        }
+        else
+        {
+            errno = EEXIST; // for the message below, not whatever remove_stale() ran into
+        }
+    }
+    if (region == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not create %llu bytes of shared memory %s: %s%s\n", (unsigned long long)layout.size,
+                name, strerror(errno), errno == EEXIST ? ", another server is using it" : "");
+        return false;
+    }
+    // name is ours now, so a region of the machines under it is left from a server that is gone
+    void *machine_region = create_region(machines, machines_size, NULL);
+    if (machine_region == MAP_FAILED && errno == EEXIST)
+    {
+        shm_unlink(machines);
+        machine_region = create_region(machines, machines_size, NULL);
+    }
+    if (machine_region == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not create %zu bytes of shared memory %s: %s\n", machines_size, machines,
+                strerror(errno));
+        munmap(region, layout.size);
+        shm_unlink(name);
+        close(fd);
+        return false;
+    }
+    memcpy(region, &layout, sizeof(layout)); // magic still zero, clients don't take it yet
+    use_regions(shm, region, layout.size, fd, machine_region, machines_size, &layout, name);
+    if (!create_envs_at(envs, shm->machines, count, rom, rom_size, config))
+    {
+        munmap(region, layout.size);
+        munmap(machine_region, machines_size);
+        shm_unlink(machines);
+        shm_unlink(name);
+        close(fd);
+        memset(shm, 0, sizeof(*shm));
+        return false;
+    }
+    atomic_thread_fence(memory_order_release);
+    memcpy(shm->header->magic, SHM_MAGIC, sizeof(shm->header->magic));
+    return true;
+}
+
+// Wait up to wait_ms for the client's next request and carry it out, return what it was, SHM_IDLE
+// if none came (or a signal cut the wait short). The reply is sent for SHM_QUIT too, it is up to the
+// caller to stop then.
+shm_command serve_shm(shm_env *shm, chip8_envs *envs, unsigned int wait_ms)
+{
+    shm_header *header = shm->header;
+    uint32_t served = atomic_load_explicit(&header->reply, memory_order_relaxed);
+    if (!wait_change(&header->request, served, wait_ms))
+    {
+        return SHM_IDLE;
+    }
+    uint32_t request = atomic_load_explicit(&header->request, memory_order_acquire);
+    shm_command command = (shm_command)header->command;
+    uint32_t frames_per_step = header->frames_per_step; // read once, the client may change it meanwhile
+    switch (command)
+    {
+        case SHM_STEP:
+            step_envs(envs, shm->actions, frames_per_step < SHM_MAX_FRAMES_PER_STEP ? frames_per_step
+                                                                                     : SHM_MAX_FRAMES_PER_STEP,
+                      NULL, shm->done, shm->rewards);
+            break;
+        case SHM_RESET:
+            reset_envs(envs);
+            memset(shm->done, 0, shm->count);
+            memset(shm->rewards, 0, shm->count * sizeof(float));
+            break;
+        case SHM_QUIT:
+            break;
+        default:
+            command = SHM_IDLE; // nothing to do, but the client still gets its reply
+            break;
+    }
+    atomic_store_explicit(&header->reply, request, memory_order_release);
+    futex_wake(&header->reply);
+    return command;
+}
+
+// unmap and remove the regions, still holding the lock, and destroy the environments in them
+void destroy_shm_server(shm_env *shm, chip8_envs *envs)
+{
+    destroy_envs(envs);
+    if (shm->header)
+    {
+        char machines[sizeof(shm->name) + sizeof(SHM_MACHINES_SUFFIX)];
+        machines_name(machines, sizeof(machines), shm->name);
+        munmap(shm->header, shm->size);
+        munmap(shm->machines, shm->machines_size);
+        shm_unlink(machines);
+        shm_unlink(shm->name);
+        close(shm->fd);
+    }
+    memset(shm, 0, sizeof(*shm));
+}
+
+// return success status of mapping the regions a server created as name, the machines read only.
+// Errors are printed
+bool open_shm_client(shm_env *shm, const char *name)
+{
+    memset(shm, 0, sizeof(*shm));
+    char machines[sizeof(shm->name) + sizeof(SHM_MACHINES_SUFFIX)];
+    machines_name(machines, sizeof(machines), name);
+    size_t size;
+    int fd;
+    void *region = open_region(name, true, &size, &fd);
+    if (region == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not open shared memory %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    shm_header layout = {0};
+    memcpy(&layout, region, size < sizeof(layout) ? size : sizeof(layout)); // checked and used from here on
+    atomic_thread_fence(memory_order_acquire);
+    bool valid = size >= sizeof(shm_header) && memcmp(layout.magic, SHM_MAGIC, sizeof(layout.magic)) == 0
+                 && layout.size == size;
+    bool fits = layout.machine_size == sizeof(chip8_machine) && layout.actions_offset >= sizeof(shm_header)
+                && layout.done_offset >= layout.actions_offset + layout.count * (uint64_t)sizeof(uint16_t)
+                && layout.rewards_offset >= layout.done_offset + layout.count
+                && layout.rewards_offset + layout.count * (uint64_t)sizeof(float) <= size;
+    size_t machines_size = 0;
+    void *machine_region = valid && fits ? open_region(machines, false, &machines_size, NULL) : MAP_FAILED;
+    if (machine_region != MAP_FAILED && machines_size != layout.count * (uint64_t)sizeof(chip8_machine))
+    {
+        munmap(machine_region, machines_size);
+        machine_region = MAP_FAILED;
+    }
+    if (machine_region == MAP_FAILED)
+    {
+        fprintf(stderr, "%s is %s\n", name, !valid ? "not ready or not an environment server"
+                                         : !fits ? "served by a different build of libchip8"
+                                                 : "missing its machines");
+        munmap(region, size);
+        close(fd);
+        return false;
+    }
+    use_regions(shm, region, size, fd, machine_region, machines_size, &layout, name);
+    return true;
+}
+
+// Have the server carry out command, with the actions in shm->actions for SHM_STEP, and wait until
+// it did: then done, rewards and the machines' displays hold the results. Returns false if the
+// server went away instead, or frames_per_step is past SHM_MAX_FRAMES_PER_STEP, errors are printed
+bool call_shm(shm_env *shm, shm_command command, unsigned int frames_per_step)
+{
+    if (frames_per_step > SHM_MAX_FRAMES_PER_STEP)
+    {
+        fprintf(stderr, "At most %d frames per step\n", SHM_MAX_FRAMES_PER_STEP);
+        return false;
+    }
+    shm_header *header = shm->header;
+    header->command = command;
+    header->frames_per_step = frames_per_step;
+    uint32_t request = atomic_load_explicit(&header->request, memory_order_relaxed) + 1;
+    atomic_store_explicit(&header->request, request, memory_order_release);
+    futex_wake(&header->request);
+    for (;;)
+    {
+        uint32_t reply = atomic_load_explicit(&header->reply, memory_order_acquire);
+        if (reply == request)
+        {
+            return true;
+        }
+        // the server holds LOCK_EX on the region until it ends, so a shared lock only comes with it gone
+        if (!wait_change(&header->reply, reply, SHM_CLIENT_WAIT_MS) && flock(shm->fd, LOCK_SH | LOCK_NB) == 0)
+        {
+            flock(shm->fd, LOCK_UN);
+            fprintf(stderr, "The server of %s is gone\n", shm->name);
+            return false;
+        }
+    }
+}
+
+void close_shm_client(shm_env *shm)
+{
+    if (shm->header)
+    {
+        munmap(shm->header, shm->size);
+        munmap(shm->machines, shm->machines_size);
+        close(shm->fd);
+    }
+    memset(shm, 0, sizeof(*shm));
+}
+#else
+bool create_shm_server(shm_env *shm, chip8_envs *envs, const char *name, uint32_t count, const uint8_t *rom,
+                       size_t rom_size, const env_config *config)
+{
+    (void)envs, (void)count, (void)rom, (void)rom_size, (void)config;
+    memset(shm, 0, sizeof(*shm));
+    fprintf(stderr, "Could not create %s: shared memory environments need Linux\n", name);
+    return false;
+}
+
+shm_command serve_shm(shm_env *shm, chip8_envs *envs, unsigned int wait_ms)
+{
+    (void)shm, (void)envs, (void)wait_ms;
+    return SHM_QUIT;
+}
+
+void destroy_shm_server(shm_env *shm, chip8_envs *envs)
+{
+    (void)envs;
+    memset(shm, 0, sizeof(*shm));
+}
+
+bool open_shm_client(shm_env *shm, const char *name)
+{
+    memset(shm, 0, sizeof(*shm));
+    fprintf(stderr, "Could not open %s: shared memory environments need Linux\n", name);
+    return false;
+}
+
+bool call_shm(shm_env *shm, shm_command command, unsigned int frames_per_step)
+{
+    (void)shm, (void)command, (void)frames_per_step;
+    return false;
+}
+
+void close_shm_client(shm_env *shm)
+{
+    memset(shm, 0, sizeof(*shm));
+}
+#endif
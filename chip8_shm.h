@@ -0,0 +1,86 @@
+// Batched environments (chip8_env.h) stepped from other processes through POSIX shared memory, part
+// of libchip8, Linux only. A server (tools/serve.c) creates a named region that holds the actions,
+// done flags and rewards of a step, and next to it a region NAME-machines that holds the machines
+// themselves. A client maps the first one, writes its actions in place and asks for a step. It maps
+// the machines read only: the observations are their packed display words, read where the server
+// left them, so no frame is copied, serialised or sent through a pipe, and a client can't change a
+// machine under the server. The server takes nothing from the region it shares with the client but
+// the request: the layout, the sizes and the pointers are its own copies in shm_env.
+//
+// A request and its reply are two sequence numbers in the region. Each side spins on them briefly,
+// then sleeps on a futex, so a step costs no system call when the other side is quick and no CPU
+// when it is not. One client at a time.
+#ifndef CHIP8_SHM_H
+#define CHIP8_SHM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "chip8_env.h"
+
+#define SHM_MAGIC "C8SHM003" // the region's first 8 bytes, changes with the layout
+#define SHM_MACHINES_SUFFIX "-machines" // added to the name for the region of the machines
+#define SHM_MAX_FRAMES_PER_STEP 3600 // a minute of emulated time, more is cut to this
+
+typedef enum {
+    SHM_IDLE, // serve_shm(): no request came in
+    SHM_STEP, // step_envs() with the actions in the region
+    SHM_RESET, // reset_envs(), done flags and rewards cleared
+    SHM_QUIT, // the server stops
+} shm_command;
+
+// Start of the region. Offsets are from the start of the region, so clients in other languages can
+// find everything from this header alone. The region NAME-machines is chip8_machine[count]: machine
+// i's display (display[DISPLAY_PLANES][HIRES_HEIGHT][2], host endian words, leftmost pixel in the most
+// significant bit) is at i * machine_size + display_offset in it, and its hires flag (a bool) at
+// hires_offset instead of display_offset says which part of it is the screen. The fields up to
+// size keep their place across layouts, a new server reads them to tell whether a region left under
+// its name is an environment server's. The server holds flock() LOCK_EX on the region as long as it
+// runs: a region whose lock is free is one a server that is gone left behind.
+typedef struct {
+    char magic[8];
+    uint32_t count;
+    uint32_t machine_size; // sizeof(chip8_machine)
+    uint32_t display_offset; // of display in chip8_machine
+    uint32_t hires_offset; // of hires in chip8_machine
+    uint32_t profile; // quirk_profile the machines run
+    uint32_t server_pid; // the server's process, for information, the lock tells whether it is still there
+    uint64_t actions_offset; // uint16_t[count], key masks written by the client (bit K for key K)
+    uint64_t done_offset; // uint8_t[count]
+    uint64_t rewards_offset; // float[count]
+    uint64_t size; // of the whole region
+    uint32_t command; // shm_command of the current request
+    uint32_t frames_per_step; // of SHM_STEP, up to SHM_MAX_FRAMES_PER_STEP
+    _Atomic uint32_t request; // incremented by the client once command and actions are in place
+    _Atomic uint32_t reply; // set to request by the server once it is carried out
+} shm_header;
+
+// one side's view of the mapped regions
+typedef struct {
+    shm_header *header;
+    chip8_machine *machines; // read only on the client
+    uint16_t *actions;
+    uint8_t *done;
+    float *rewards;
+    uint32_t count;
+    size_t size; // of the mapping of the region, header->size is the other side's to overwrite
+    size_t machines_size; // of the mapping of the machines
+    int fd; // of the region, the server holds its lock through it, the client tries the lock on it
+    char name[256]; // of the region, the server unlinks it and NAME-machines when done
+} shm_env;
+
+// server
+bool create_shm_server(shm_env *shm, chip8_envs *envs, const char *name, uint32_t count, const uint8_t *rom,
+                       size_t rom_size, const env_config *config);
+shm_command serve_shm(shm_env *shm, chip8_envs *envs, unsigned int wait_ms);
+void destroy_shm_server(shm_env *shm, chip8_envs *envs);
+
+// client
+bool open_shm_client(shm_env *shm, const char *name);
+bool call_shm(shm_env *shm, shm_command command, unsigned int frames_per_step);
+void close_shm_client(shm_env *shm);
+
+#endif // CHIP8_SHM_H
@@ -0,0 +1,124 @@
+// Buffered WAV writer, see chip8_wav.h
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_wav.h"
+
+#define WAV_HEADER_SIZE 44
+
+// WAV is little endian regardless of the host, so build the header byte by byte
+static void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    put_u16(out, value & 0xFFFF);
+    put_u16(out + 2, value >> 16);
+}
+
+static bool write_header(wav_writer *wav)
+{
+    uint8_t header[WAV_HEADER_SIZE] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+                                       'f', 'm', 't', ' ', 0, 0, 0, 0, 0, 0, 0, 0,
+                                       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                       'd', 'a', 't', 'a', 0, 0, 0, 0};
+    put_u32(&header[4], WAV_HEADER_SIZE - 8 + wav->data_bytes); // RIFF chunk size
+    put_u32(&header[16], 16); // fmt chunk size
+    put_u16(&header[20], 1); // PCM
+    put_u16(&header[22], 1); // mono
+    put_u32(&header[24], wav->sample_rate);
+    put_u32(&header[28], wav->sample_rate * 2); // byte rate
+    put_u16(&header[32], 2); // block align
+    put_u16(&header[34], 16); // bits per sample
+    put_u32(&header[40], wav->data_bytes);
+    return fwrite(header, sizeof(header), 1, wav->file) == 1;
+}
+
+static void flush_wav(wav_writer *wav)
+{
+    if (wav->buffered == 0)
+    {
+        return;
+    }
+    // samples are stored in host order, swap them on big endian hosts
+    const uint16_t probe = 1;
+    if (*(const uint8_t *)&probe == 0)
+    {
+        for (uint32_t i = 0; i < wav->buffered; i++)
+        {
+            uint16_t sample = (uint16_t)wav->buffer[i];
+            wav->buffer[i] = (int16_t)(uint16_t)((sample << 8) | (sample >> 8));
+        }
+    }
+    if (wav->data_bytes > UINT32_MAX - WAV_HEADER_SIZE - wav->buffered * sizeof(int16_t))
+    {
+        wav->failed = true; // the RIFF sizes are 32-bit, about 12 hours at 48kHz
+        wav->buffered = 0;
+        return;
+    }
+    if (fwrite(wav->buffer, sizeof(int16_t), wav->buffered, wav->file) != wav->buffered)
+    {
+        wav->failed = true;
+    }
+    wav->data_bytes += wav->buffered * sizeof(int16_t);
+    wav->buffered = 0;
+}
+
+// return success status of creating the file, the header is rewritten with the real sizes on close
+bool open_wav(wav_writer *wav, const char *path, int sample_rate)
+{
+    wav->file = fopen(path, "wb");
+    if (!wav->file)
+    {
+        fprintf(stderr, "Could not create %s\n", path);
+        return false;
+    }
+    wav->sample_rate = sample_rate;
+    wav->data_bytes = 0;
+    wav->buffered = 0;
+    wav->failed = !write_header(wav);
+    return true;
+}
+
+// append float samples in [-1, 1], converted to 16-bit PCM
+void write_wav(wav_writer *wav, const float *samples, uint32_t count)
+{
+    while (count > 0)
+    {
+        uint32_t space = WAV_BUFFER_SAMPLES - wav->buffered;
+        uint32_t chunk = count < space ? count : space;
+        int16_t *out = &wav->buffer[wav->buffered];
+        for (uint32_t i = 0; i < chunk; i++)
+        {
+            float sample = samples[i] > 1.0f ? 1.0f : (samples[i] < -1.0f ? -1.0f : samples[i]);
+            out[i] = (int16_t)(sample * 32767.0f);
+        }
+        wav->buffered += chunk;
+        samples += chunk;
+        count -= chunk;
+        if (wav->buffered == WAV_BUFFER_SAMPLES)
+        {
+            flush_wav(wav);
+        }
+    }
+}
+
+// return success status of everything written since open_wav()
+bool close_wav(wav_writer *wav)
+{
+    flush_wav(wav);
+    if (fseek(wav->file, 0, SEEK_SET) != 0 || !write_header(wav))
+    {
+        wav->failed = true;
+    }
+    if (fclose(wav->file) != 0)
+    {
+        wav->failed = true;
+    }
+    wav->file = NULL;
+    return !wav->failed;
+}
@@ -0,0 +1,24 @@
+// Buffered WAV (16-bit PCM, mono) writer for offline beeper rendering, part of libchip8.
+#ifndef CHIP8_WAV_H
+#define CHIP8_WAV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define WAV_BUFFER_SAMPLES 32768 // samples converted and flushed per fwrite (64kb)
+
+typedef struct {
+    FILE *file;
+    int sample_rate;
+    uint32_t data_bytes; // PCM bytes written so far, patched into the header on close
+    uint32_t buffered;
+    bool failed; // a write failed, close_wav() reports it
+    int16_t buffer[WAV_BUFFER_SAMPLES];
+} wav_writer;
+
+bool open_wav(wav_writer *wav, const char *path, int sample_rate);
+void write_wav(wav_writer *wav, const float *samples, uint32_t count);
+bool close_wav(wav_writer *wav);
+
+#endif // CHIP8_WAV_H
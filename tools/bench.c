@@ -0,0 +1,299 @@
+// Whole-ROM benchmark driver.
+//
+//   bench [--frames N] [--runs N] [--json FILE] [--baseline FILE] [--threshold PERCENT] [ROM...]
+//
+// Runs every ROM (the bundled ones by default) headless with scripted_keys() as input for a fixed
+// number of emulated frames, several times over, and reports median/min/p99 of
+//   ips           emulated instructions per second, one sample per run
+//   ns_per_frame  time spent in run_frame(), one sample per block of BENCH_BLOCK_FRAMES frames
+//   render_ns     time to convert the framebuffer into ARGB pixels (what a texture upload needs),
+//                 one sample per block of as many renders of the screen the block ended on
+// as JSON, with a checksum of the rendered pixels. Frames are timed in blocks because a frame is a
+// few dozen nanoseconds, about what reading the clock costs. With --baseline the results are
+// compared with an earlier JSON report of the same machine, and the exit status is non-zero if a
+// median regressed by more than the threshold, or the baseline is missing or lacks one of the ROMs.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define BENCH_DEFAULT_FRAMES 10000
+#define BENCH_DEFAULT_RUNS 7
+#define BENCH_DEFAULT_THRESHOLD 10.0 // percent
+#define BENCH_BLOCK_FRAMES 100 // frames between two clock readings
+
+typedef struct {
+    double median;
+    double min;
+    double p99;
+} bench_stats;
+
+typedef struct {
+    const char *rom;
+    bench_stats ips;
+    bench_stats ns_per_frame;
+    bench_stats render_ns;
+    uint32_t render_checksum; // of every pixel rendered, keeps the renders from being optimised away
+} bench_result;
+
+static uint32_t pixels[HIRES_WIDTH * HIRES_HEIGHT];
+
+static const uint32_t palette[4] = {0xFF000000u, 0xFFFFFFFFu, 0xFFAAAAAAu, 0xFF555555u};
+
+// headless stand-in for update_screen(): expand the framebuffer into ARGB8888 pixels, return a
+// checksum of them
+static uint32_t render_frame(const chip8_machine *chip8)
+{
+    unsigned int width = display_width(chip8);
+    uint32_t checksum = 0;
+    for (unsigned int y = 0; y < display_height(chip8); y++)
+    {
+        for (unsigned int x = 0; x < width; x++)
+        {
+            uint32_t pixel = palette[display_pixel(chip8, x, y)];
+            pixels[y * width + x] = pixel;
+            checksum = (checksum << 1 | checksum >> 31) ^ pixel;
+        }
+    }
+    return checksum;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static bench_stats summarize(double *samples, size_t count)
+{
+    qsort(samples, count, sizeof(double), compare_doubles);
+    bench_stats stats = {
+        .median = samples[count / 2],
+        .min = samples[0],
+        .p99 = samples[(count * 99) / 100 < count ? (count * 99) / 100 : count - 1],
+    };
+    return stats;
+}
+
+static bool bench_rom(const char *path, uint32_t frames, uint32_t runs, bench_result *result)
+{
+    size_t rom_size;
+    uint8_t *rom = read_file(path, &rom_size);
+    if (!rom)
+    {
+        fprintf(stderr, "Could not load ROM %s\n", path);
+        return false;
+    }
+
+    static chip8_machine chip8;
+    size_t blocks = (frames + BENCH_BLOCK_FRAMES - 1) / BENCH_BLOCK_FRAMES;
+    double *ips = malloc(runs * sizeof(double));
+    double *frame_ns = malloc((size_t)runs * blocks * sizeof(double));
+    double *render_ns = malloc((size_t)runs * blocks * sizeof(double));
+    bool ok = ips && frame_ns && render_ns;
+    uint32_t checksum = 0;
+
+    for (uint32_t run = 0; ok && run < runs; run++)
+    {
+        if (!load_rom(&chip8, rom, rom_size))
+        {
+            fprintf(stderr, "ROM %s does not fit in memory\n", path);
+            ok = false;
+            break;
+        }
+        seed_chip8(&chip8, 1);
+
+        instruction instr;
+        uint64_t emulation_ns = 0;
+        for (size_t block = 0; block < blocks; block++)
+        {
+            uint32_t first = (uint32_t)block * BENCH_BLOCK_FRAMES;
+            uint32_t count = frames - first < BENCH_BLOCK_FRAMES ? frames - first : BENCH_BLOCK_FRAMES;
+
+            uint64_t start = now_ns();
+            for (uint32_t frame = first; frame < first + count; frame++)
+            {
+                apply_keys(&chip8, scripted_keys(frame));
+                run_frame(&chip8, &instr, INSTRUCTIONS_PER_FRAME);
+            }
+            uint64_t emulated = now_ns();
+            for (uint32_t i = 0; i < count; i++)
+            {
+                checksum += render_frame(&chip8);
+            }
+            uint64_t rendered = now_ns();
+
+            emulation_ns += emulated - start;
+            frame_ns[(size_t)run * blocks + block] = (double)(emulated - start) / count;
+            render_ns[(size_t)run * blocks + block] = (double)(rendered - emulated) / count;
+        }
+        ips[run] = (double)frames * INSTRUCTIONS_PER_FRAME * 1e9 / (double)(emulation_ns ? emulation_ns : 1);
+    }
+
+    if (ok)
+    {
+        result->rom = path;
+        result->ips = summarize(ips, runs);
+        result->ns_per_frame = summarize(frame_ns, (size_t)runs * blocks);
+        result->render_ns = summarize(render_ns, (size_t)runs * blocks);
+        result->render_checksum = checksum;
+    }
+    free(ips);
+    free(frame_ns);
+    free(render_ns);
+    free(rom);
+    return ok;
+}
+
+static void write_stats(FILE *out, const char *name, const bench_stats *stats, bool last)
+{
+    fprintf(out, "      \"%s\": {\"median\": %.1f, \"min\": %.1f, \"p99\": %.1f}%s\n",
+            name, stats->median, stats->min, stats->p99, last ? "" : ",");
+}
+
+static void write_json(FILE *out, const bench_result *results, int count, uint32_t frames, uint32_t runs)
+{
+    fprintf(out, "{\n  \"frames\": %u,\n  \"runs\": %u,\n  \"instructions_per_frame\": %u,\n  \"roms\": [\n",
+            frames, runs, INSTRUCTIONS_PER_FRAME);
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(out, "    {\n      \"rom\": \"%s\",\n", results[i].rom);
+        write_stats(out, "ips", &results[i].ips, false);
+        write_stats(out, "ns_per_frame", &results[i].ns_per_frame, false);
+        write_stats(out, "render_ns", &results[i].render_ns, false);
+        fprintf(out, "      \"render_checksum\": \"%08X\"\n", (unsigned int)results[i].render_checksum);
+        fprintf(out, "    }%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Pull "<metric>": {"median": X} for one ROM out of a report written by write_json(). Not a
+// general JSON parser, it only needs to read back our own output.
+static bool baseline_median(const char *json, const char *rom, const char *metric, double *value)
+{
+    char key[512];
+    snprintf(key, sizeof(key), "\"rom\": \"%s\"", rom);
+    const char *entry = strstr(json, key);
+    if (!entry)
+    {
+        return false;
+    }
+    snprintf(key, sizeof(key), "\"%s\": {\"median\": ", metric);
+    const char *found = strstr(entry, key);
+    const char *next_entry = strstr(entry + 1, "\"rom\": ");
+    if (!found || (next_entry && found > next_entry))
+    {
+        return false;
+    }
+    *value = strtod(found + strlen(key), NULL);
+    return true;
+}
+
+// returns the number of ROMs that regressed past the threshold or have nothing to compare with
+static int compare_baseline(const char *path, const bench_result *results, int count, double threshold)
+{
+    size_t size;
+    char *json = (char *)read_file(path, &size);
+    if (!json)
+    {
+        fprintf(stderr, "No baseline at %s, record one on this machine first (make bench-baseline)\n", path);
+        return count;
+    }
+    json = realloc(json, size + 1);
+    json[size] = '\0';
+
+    int regressions = 0;
+    for (int i = 0; i < count; i++)
+    {
+        double old_ips, old_frame;
+        if (!baseline_median(json, results[i].rom, "ips", &old_ips) ||
+            !baseline_median(json, results[i].rom, "ns_per_frame", &old_frame))
+        {
+            fprintf(stderr, "%s: not in baseline, record it again (make bench-baseline)\n", results[i].rom);
+            regressions++;
+            continue;
+        }
+
+        double ips_change = (results[i].ips.median - old_ips) * 100.0 / old_ips;
+        double frame_change = (results[i].ns_per_frame.median - old_frame) * 100.0 / old_frame;
+        bool regressed = ips_change < -threshold || frame_change > threshold;
+        fprintf(stderr, "%s: ips %+.1f%%, ns/frame %+.1f%%%s\n", results[i].rom, ips_change, frame_change,
+                regressed ? "  REGRESSION" : "");
+        regressions += regressed;
+    }
+    free(json);
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *default_roms[] = {"Pong.ch8", "Tetris.ch8", "test_opcode.ch8"};
+    const char *roms[64];
+    int rom_count = 0;
+    uint32_t frames = BENCH_DEFAULT_FRAMES;
+    uint32_t runs = BENCH_DEFAULT_RUNS;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    const char *json_path = NULL;
+    const char *baseline_path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value)
+            frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--runs") == 0 && has_value)
+            runs = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--json") == 0 && has_value)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+            baseline_path = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && has_value)
+            threshold = strtod(argv[++i], NULL);
+        else if (argv[i][0] != '-' && rom_count < 64)
+            roms[rom_count++] = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s [--frames N] [--runs N] [--json FILE] [--baseline FILE] [--threshold PERCENT] [ROM...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (rom_count == 0)
+    {
+        for (rom_count = 0; rom_count < 3; rom_count++)
+            roms[rom_count] = default_roms[rom_count];
+    }
+    if (frames == 0 || runs == 0)
+    {
+        fprintf(stderr, "--frames and --runs must be at least 1\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_result results[64];
+    for (int i = 0; i < rom_count; i++)
+    {
+        if (!bench_rom(roms[i], frames, runs, &results[i]))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    write_json(stdout, results, rom_count, frames, runs);
+    if (json_path)
+    {
+        FILE *out = fopen(json_path, "w");
+        if (!out)
+        {
+            fprintf(stderr, "Could not create %s\n", json_path);
+            return EXIT_FAILURE;
+        }
+        write_json(out, results, rom_count, frames, runs);
+        fclose(out);
+    }
+
+    if (baseline_path && compare_baseline(baseline_path, results, rom_count, threshold) > 0)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
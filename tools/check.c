@@ -0,0 +1,427 @@
+// Differential checks of the libchip8 parts the golden traces don't cover, against plain
+// run_frame() models of them.
+//
+//   check env [ROM...]        step batched environments (chip8_env.h), stop at the first step that differs
+//   check lockstep [ROM...]   run blocks of machines with run_frame_lockstep() (chip8_lockstep.h), stop
+//                             at the first frame that differs
+//
+// env runs every ROM given under PROFILE_CHIP8, plus a built-in XO-CHIP ROM that draws random
+// sprites on both planes in hires and stores random numbers at ENV_CHECK_REWARD, under every
+// observation format, with and without lockstep. Next to the environments the same machines run
+// frame by frame with run_frame() and the same actions, restarting from the ROM with seed + i + e * count
+// when episode e of machine i ends. After every step each machine has to match its model byte for
+// byte, its observation has to match display_pixel() of the model, and its reward the change of the
+// big endian number at ENV_CHECK_REWARD (1 to 4 bytes, both signs). make env-check runs it.
+//
+// lockstep runs LOCKSTEP_CHECK_ROMS random ROMs, generated from a fixed seed, and every ROM given, under
+// every profile on a whole block of machines and a partial one. Two machines are skipped, so the
+// first block is gathered around them. It gets the same input and every other machine in it the same
+// seed, so it stays in step with different CXNN numbers in its lanes until those make it branch; the
+// partial block's machines go their own ways. After every frame each machine has to match
+// the same machine run with run_frame() byte for byte. make lockstep-check runs it.
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "../chip8_env.h"
+#include "../chip8_lockstep.h"
+
+#define ENV_CHECK_COUNT 37 // a whole lockstep block of 32 machines and a partial one
+#define ENV_CHECK_STEPS 60
+#define ENV_CHECK_FRAMES_PER_STEP 4
+#define ENV_CHECK_MAX_FRAMES 23 // episodes end part way through a step
+#define ENV_CHECK_SEED 7
+#define ENV_CHECK_REWARD 0x402 // V2-V5 as the built-in ROM stores them
+#define LOCKSTEP_CHECK_ROMS 300
+#define LOCKSTEP_CHECK_ROM_WORDS 256 // longest random ROM, in instructions
+#define LOCKSTEP_CHECK_COUNT (LOCKSTEP_LANES + 8)
+#define LOCKSTEP_CHECK_SKIP_A 4 // machines that never run, the first block is gathered around them
+#define LOCKSTEP_CHECK_SKIP_B 19
+#define LOCKSTEP_CHECK_IN_STEP (LOCKSTEP_LANES + 2) // machines with the same input, the first block
+#define LOCKSTEP_CHECK_FRAMES 60
+#define LOCKSTEP_CHECK_SEED 0x4C53u
+
+// built-in ROM: hires, both planes, then forever a sprite from the ROM itself at a random position
+// and V0-V5 (V2-V5 random) stored at 0x400
+static const uint8_t env_check_rom[] = {
+    0x00, 0xFF, // 200: 00FF  hires
+    0xF3, 0x01, // 202: F301  draw on both planes
+    0xC0, 0x7F, // 204: C07F  V0 = random x
+    0xC1, 0x3F, // 206: C13F  V1 = random y
+    0xA2, 0x00, // 208: A200  I = 200
+    0xD0, 0x1F, // 20A: D01F  draw 15 rows on each plane
+    0xC2, 0xFF, // 20C: C2FF  V2-V5 = random
+    0xC3, 0xFF, // 20E: C3FF
+    0xC4, 0xFF, // 210: C4FF
+    0xC5, 0xFF, // 212: C5FF
+    0xA4, 0x00, // 214: A400  I = 400
+    0xF5, 0x55, // 216: F555  store V0-V5
+    0x12, 0x04, // 218: 1204  loop
+};
+
+// the observation formats checked, each with and without lockstep
+static const env_config env_check_formats[] = {
+    {.observation = ENV_OBSERVE_BITS, .planes = 1},
+    {.observation = ENV_OBSERVE_BITS, .planes = 2},
+    {.observation = ENV_OBSERVE_BITS, .planes = 1, .hires = true},
+    {.observation = ENV_OBSERVE_BITS, .planes = 2, .hires = true},
+    {.observation = ENV_OBSERVE_BYTES},
+    {.observation = ENV_OBSERVE_BYTES, .hires = true},
+};
+
+// a model of one environment
+typedef struct {
+    chip8_machine chip8;
+    uint32_t frames;
+    uint32_t episodes;
+    bool ended;
+} env_model;
+
+static uint32_t read_number(const chip8_machine *chip8, uint16_t address, unsigned int bytes)
+{
+    uint32_t number = 0;
+    for (unsigned int i = 0; i < bytes; i++)
+    {
+        number = number << 8 | chip8->ram[(uint16_t)(address + i)];
+    }
+    return number;
+}
+
+// return whether observation is the screen of chip8 in the format of config, the first differing pixel
+// is printed
+static bool check_observation(const env_config *config, const chip8_machine *chip8, const uint8_t *observation)
+{
+    unsigned int width = config->hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    unsigned int height = config->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    unsigned int planes = config->observation == ENV_OBSERVE_BYTES ? 1 : config->planes;
+    for (unsigned int plane = 0; plane < planes; plane++)
+    {
+        for (unsigned int y = 0; y < height; y++)
+        {
+            for (unsigned int x = 0; x < width; x++)
+            {
+                unsigned int observed, expected = display_pixel(chip8, x, y);
+                if (config->observation == ENV_OBSERVE_BYTES)
+                {
+                    observed = observation[y * width + x];
+                }
+                else
+                {
+                    observed = observation[(plane * height + y) * (width / 8) + x / 8] >> (7 - x % 8) & 1;
+                    expected = expected >> plane & 1;
+                }
+                if (observed != expected)
+                {
+                    printf("pixel %u,%u of plane %u observed as %u instead of %u\n", x, y, plane, observed, expected);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// return whether the environments of rom under config match their models for ENV_CHECK_STEPS steps,
+// the first difference is printed
+static bool check_envs(const char *name, const uint8_t *rom, size_t rom_size, const env_config *config)
+{
+    chip8_envs envs;
+    if (!create_envs(&envs, ENV_CHECK_COUNT, rom, rom_size, config))
+    {
+        return false;
+    }
+    static chip8_machine start;
+    load_rom(&start, rom, rom_size);
+    size_t observation_size = env_observation_size(config);
+    env_model *models = malloc(ENV_CHECK_COUNT * sizeof(env_model));
+    uint8_t *observations = malloc(ENV_CHECK_COUNT * observation_size);
+    uint16_t actions[ENV_CHECK_COUNT];
+    uint8_t done[ENV_CHECK_COUNT];
+    float rewards[ENV_CHECK_COUNT];
+    if (!models || !observations)
+    {
+        fprintf(stderr, "Out of memory\n");
+        free(models);
+        free(observations);
+        destroy_envs(&envs);
+        return false;
+    }
+    for (uint32_t i = 0; i < ENV_CHECK_COUNT; i++)
+    {
+        models[i] = (env_model){.ended = true};
+    }
+
+    bool ok = true;
+    instruction instr;
+    for (unsigned int step = 0; step < ENV_CHECK_STEPS && ok; step++)
+    {
+        for (uint32_t i = 0; i < ENV_CHECK_COUNT && ok; i++)
+        {
+            env_model *model = &models[i];
+            actions[i] = scripted_keys(step * ENV_CHECK_FRAMES_PER_STEP + i * 7);
+            if (model->ended)
+            {
+                model->chip8 = start;
+                seed_chip8(&model->chip8, config->seed + i + model->episodes * ENV_CHECK_COUNT);
+                model->chip8.profile = config->profile;
+                model->frames = 0;
+                model->episodes++;
+            }
+            uint32_t before = read_number(&model->chip8, config->reward_address, config->reward_bytes);
+            model->chip8.keys = actions[i];
+            model->ended = false;
+            for (unsigned int frame = 0; frame < ENV_CHECK_FRAMES_PER_STEP && !model->ended; frame++)
+            {
+                run_frame(&model->chip8, &instr, config->instructions_per_frame);
+                model->ended = model->chip8.halted || ++model->frames == config->max_frames;
+            }
+            rewards[i] = (float)((int64_t)read_number(&model->chip8, config->reward_address, config->reward_bytes)
+                                 - (int64_t)before); // the expected one until step_envs() overwrites it
+        }
+        float expected_rewards[ENV_CHECK_COUNT];
+        memcpy(expected_rewards, rewards, sizeof(rewards));
+        step_envs(&envs, actions, ENV_CHECK_FRAMES_PER_STEP, observations, done, rewards);
+
+        for (uint32_t i = 0; i < ENV_CHECK_COUNT && ok; i++)
+        {
+            const env_model *model = &models[i];
+            if (memcmp(&envs.machines[i], &model->chip8, sizeof(chip8_machine)) != 0)
+            {
+                printf("%s: machine %u differs from run_frame() after step %u (episode %u)\n", name, i, step,
+                       model->episodes);
+                ok = false;
+            }
+            else if (done[i] != model->ended)
+            {
+                printf("%s: machine %u done %u instead of %u after step %u\n", name, i, done[i], model->ended, step);
+                ok = false;
+            }
+            else if (rewards[i] != expected_rewards[i])
+            {
+                printf("%s: machine %u reward %.0f instead of %.0f after step %u\n", name, i, (double)rewards[i],
+                       (double)expected_rewards[i], step);
+                ok = false;
+            }
+            else if (!check_observation(config, &model->chip8, observations + i * observation_size))
+            {
+                printf("%s: machine %u observation differs from display_pixel() after step %u\n", name, i, step);
+                ok = false;
+            }
+        }
+    }
+    free(models);
+    free(observations);
+    destroy_envs(&envs);
+    return ok;
+}
+
+static int check_env_roms(int count, char **paths)
+{
+    size_t configs = sizeof(env_check_formats) / sizeof(env_check_formats[0]) * 2;
+    for (int rom_index = -1; rom_index < count; rom_index++)
+    {
+        const char *name = rom_index < 0 ? "built-in XO-CHIP ROM" : paths[rom_index];
+        size_t rom_size = sizeof(env_check_rom);
+        uint8_t *rom = rom_index < 0 ? (uint8_t *)env_check_rom : read_file(name, &rom_size);
+        if (!rom)
+        {
+            fprintf(stderr, "Could not read %s\n", name);
+            return EXIT_FAILURE;
+        }
+        bool ok = true;
+        for (size_t i = 0; i < configs && ok; i++)
+        {
+            env_config config = env_check_formats[i / 2];
+            config.profile = rom_index < 0 ? PROFILE_XOCHIP : PROFILE_CHIP8;
+            config.instructions_per_frame = INSTRUCTIONS_PER_FRAME;
+            config.seed = ENV_CHECK_SEED;
+            config.max_frames = ENV_CHECK_MAX_FRAMES;
+            config.reward_address = ENV_CHECK_REWARD;
+            config.reward_bytes = (uint8_t)(i % 4 + 1);
+            config.lockstep = i % 2;
+            ok = check_envs(name, rom, rom_size, &config);
+        }
+        if (rom_index >= 0)
+        {
+            free(rom);
+        }
+        if (!ok)
+        {
+            return EXIT_FAILURE;
+        }
+        printf("%s: %zu environment configurations x %u steps match run_frame()\n", name, configs, ENV_CHECK_STEPS);
+    }
+    return EXIT_SUCCESS;
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// A random ROM of instructions that exist: 0NNN, EXNN, FXNN, 5XYN and 8XYN are picked from the ones
+// the profiles know, jumps and calls go to an instruction of the ROM. Returns its size
+static size_t random_rom(uint32_t *state, uint8_t *rom)
+{
+    static const uint8_t system[] = {0xE0, 0xEE, 0xFB, 0xFC, 0xFE, 0xFF, 0xC2, 0xD3};
+    static const uint8_t misc[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x30, 0x33, 0x55, 0x65, 0x75, 0x85, 0x01, 0x02, 0x3A};
+    static const uint8_t alu[] = {0, 1, 2, 3, 4, 5, 6, 7, 0xE};
+    unsigned int words = 1 + next_random(state) % LOCKSTEP_CHECK_ROM_WORDS;
+    for (unsigned int i = 0; i < words; i++)
+    {
+        uint16_t opcode = (uint16_t)next_random(state);
+        unsigned int target = BEGIN_LOCATION + 2 * (next_random(state) % words), pick = next_random(state);
+        switch (opcode >> 12)
+        {
+        case 0x0:
+            opcode = system[pick % sizeof(system)];
+            break;
+        case 0x1:
+        case 0x2:
+        case 0xB:
+            opcode = (uint16_t)((opcode & 0xF000) | target);
+            break;
+        case 0x5:
+            opcode = (uint16_t)((opcode & 0xFFF0) | pick % 4);
+            break;
+        case 0x8:
+            opcode = (uint16_t)((opcode & 0xFFF0) | alu[pick % sizeof(alu)]);
+            break;
+        case 0xE:
+            opcode = (uint16_t)((opcode & 0xFF00) | (pick & 1 ? 0x9E : 0xA1));
+            break;
+        case 0xF:
+            opcode = (uint16_t)((opcode & 0xFF00) | misc[pick % sizeof(misc)]);
+            break;
+        }
+        rom[2 * i] = (uint8_t)(opcode >> 8);
+        rom[2 * i + 1] = (uint8_t)opcode;
+    }
+    return 2 * words;
+}
+
+// return whether LOCKSTEP_CHECK_COUNT machines running rom under profile match run_frame() every frame,
+// the first difference is printed
+static bool check_lockstep(const char *name, const uint8_t *rom, size_t rom_size, quirk_profile profile,
+                           chip8_machine *scalar, chip8_machine *lockstep, lockstep_stats *stats)
+{
+    for (uint32_t i = 0; i < LOCKSTEP_CHECK_COUNT; i++)
+    {
+        if (!load_rom(&scalar[i], rom, rom_size))
+        {
+            fprintf(stderr, "%s is too large\n", name);
+            return false;
+        }
+        seed_chip8(&scalar[i], i % 2 == 0 ? DEFAULT_SEED : i);
+        scalar[i].profile = profile;
+    }
+    memcpy(lockstep, scalar, LOCKSTEP_CHECK_COUNT * sizeof(chip8_machine));
+    instruction instr;
+    uint8_t skip[LOCKSTEP_CHECK_COUNT];
+    for (unsigned int frame = 0; frame < LOCKSTEP_CHECK_FRAMES; frame++)
+    {
+        for (uint32_t i = 0; i < LOCKSTEP_CHECK_COUNT; i++)
+        {
+            uint16_t keys = i < LOCKSTEP_CHECK_IN_STEP ? scripted_keys(frame) : scripted_keys(frame + i);
+            scalar[i].keys = lockstep[i].keys = keys;
+            skip[i] = i == LOCKSTEP_CHECK_SKIP_A || i == LOCKSTEP_CHECK_SKIP_B;
+            if (!skip[i])
+            {
+                run_frame(&scalar[i], &instr, INSTRUCTIONS_PER_FRAME);
+            }
+        }
+        run_frame_lockstep(lockstep, LOCKSTEP_CHECK_COUNT, INSTRUCTIONS_PER_FRAME, skip, stats);
+        for (uint32_t i = 0; i < LOCKSTEP_CHECK_COUNT; i++)
+        {
+            // RAM only after frames that wrote it and after the last one, the rest of the machine every
+            // frame: a whole machine is mostly RAM
+            size_t from = scalar[i].ram_dirty || lockstep[i].ram_dirty || frame + 1 == LOCKSTEP_CHECK_FRAMES
+                              ? 0 : offsetof(chip8_machine, display);
+            if (memcmp((uint8_t *)&scalar[i] + from, (uint8_t *)&lockstep[i] + from, sizeof(chip8_machine) - from) != 0)
+            {
+                printf("%s (%s): machine %u differs from run_frame() after frame %u, PC %04X instead of %04X\n",
+                       name, profile_name(profile), i, frame, lockstep[i].PC, scalar[i].PC);
+                return false;
+            }
+            scalar[i].ram_dirty = lockstep[i].ram_dirty = false;
+        }
+    }
+    return true;
+}
+
+static int check_lockstep_roms(int count, char **paths)
+{
+    chip8_machine *scalar = calloc(LOCKSTEP_CHECK_COUNT, sizeof(chip8_machine));
+    chip8_machine *lockstep = calloc(LOCKSTEP_CHECK_COUNT, sizeof(chip8_machine));
+    if (!scalar || !lockstep)
+    {
+        fprintf(stderr, "Out of memory\n");
+        free(scalar);
+        free(lockstep);
+        return EXIT_FAILURE;
+    }
+    lockstep_stats stats = {0};
+    uint32_t state = LOCKSTEP_CHECK_SEED;
+    static uint8_t random[2 * LOCKSTEP_CHECK_ROM_WORDS];
+    bool ok = true;
+    for (int rom_index = -LOCKSTEP_CHECK_ROMS; rom_index < count && ok; rom_index++)
+    {
+        char name[32];
+        size_t rom_size;
+        uint8_t *rom;
+        if (rom_index < 0)
+        {
+            snprintf(name, sizeof(name), "random ROM %d", rom_index + LOCKSTEP_CHECK_ROMS);
+            rom_size = random_rom(&state, random);
+            rom = random;
+        }
+        else if (!(rom = read_file(paths[rom_index], &rom_size)))
+        {
+            fprintf(stderr, "Could not read %s\n", paths[rom_index]);
+            ok = false;
+            break;
+        }
+        for (int profile = 0; profile < PROFILE_COUNT && ok; profile++)
+        {
+            ok = check_lockstep(rom_index < 0 ? name : paths[rom_index], rom, rom_size, (quirk_profile)profile,
+                                scalar, lockstep, &stats);
+        }
+        if (rom_index >= 0)
+        {
+            free(rom);
+        }
+    }
+    free(scalar);
+    free(lockstep);
+    if (!ok)
+    {
+        return EXIT_FAILURE;
+    }
+    uint64_t executed = stats.vector_instructions + stats.scalar_instructions;
+    printf("%d random and %d given ROMs x %d profiles x %u frames of %u machines match run_frame() (%s, %.1f%% of "
+           "the instructions executed once per block)\n", LOCKSTEP_CHECK_ROMS, count, PROFILE_COUNT,
+           LOCKSTEP_CHECK_FRAMES, LOCKSTEP_CHECK_COUNT, lockstep_isa(),
+           executed ? 100.0 * (double)stats.vector_instructions / (double)executed : 0.0);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "env") == 0)
+    {
+        return check_env_roms(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "lockstep") == 0)
+    {
+        return check_lockstep_roms(argc - 2, argv + 2);
+    }
+
+    fprintf(stderr, "usage: %s env [ROM...]\n"
+                    "       %s lockstep [ROM...]\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
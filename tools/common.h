@@ -0,0 +1,74 @@
+// Small helpers shared by the headless tools (trace runner, benchmarks)
+#ifndef CHIP8_TOOLS_COMMON_H
+#define CHIP8_TOOLS_COMMON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../chip8.h"
+
+// monotonic clock in nanoseconds (tools are built with _POSIX_C_SOURCE for clock_gettime)
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// read a whole file into a malloc'd buffer, returns NULL on failure
+static inline uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+
+    uint8_t *data = malloc(file_size > 0 ? (size_t)file_size : 1);
+    if (data && file_size > 0 && fread(data, file_size, 1, file) != 1)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = file_size > 0 ? (size_t)file_size : 0;
+    return data;
+}
+
+// 64-bit FNV-1a, cheap and good enough to tell two framebuffers or ROMs apart
+static inline uint64_t fnv1a64(const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Deterministic input used by headless runs so they are reproducible: every 30 frames the next
+// keypad key is held down for 10 frames. Returns a bit per key (bit 0 = key 0).
+static inline uint16_t scripted_keys(uint32_t frame)
+{
+    uint32_t step = frame / 30;
+    if (frame % 30 >= 10)
+    {
+        return 0;
+    }
+    return (uint16_t)(1u << (step % 16));
+}
+
+static inline void apply_keys(chip8_machine *chip8, uint16_t keys)
+{
+    chip8->keys = keys;
+}
+
+#endif // CHIP8_TOOLS_COMMON_H
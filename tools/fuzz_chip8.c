@@ -0,0 +1,153 @@
+// In-process fuzzing harness for execute_instruction().
+//
+// Built with clang and -fsanitize=fuzzer this is a libFuzzer target. Every input is a small header
+// followed by a ROM: byte 0 picks the quirk profile (each profile is its own specialised
+// interpreter), bytes 1-8 are four key masks (little endian) held one frame each in turn, so the
+// keypad instructions see keys the fuzzer chose. The ROM is loaded at BEGIN_LOCATION and run for a
+// bounded number of instructions. Faults the machine records (stack overflow or underflow, access
+// past the end of RAM) are the ROM's bugs and the machine stays safe through them, so they are only
+// recorded: what the fuzzer hunts are memory errors of the emulator, which AddressSanitizer reports.
+// Build with -DFUZZ_ABORT_ON_FAULT=1 to have recorded faults abort like a crash too, to collect ROMs
+// that fault. Built with -DFUZZ_STANDALONE it becomes a small driver that replays
+// files given on the command line (e.g. crash reproducers). Build it together with
+// AddressSanitizer so anything reaching outside the machine is reported.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../chip8.h"
+
+#define FUZZ_INSTRUCTION_BUDGET 1000 // instructions executed per input
+#define FUZZ_INSTRUCTIONS_PER_FRAME 10 // how often the 60Hz timers tick, measured in instructions
+#define FUZZ_KEY_MASKS 4
+#define FUZZ_HEADER (1 + 2 * FUZZ_KEY_MASKS) // profile byte, key masks
+
+#ifndef FUZZ_ABORT_ON_FAULT
+#define FUZZ_ABORT_ON_FAULT 0
+#endif
+
+// Extra coverage counters. libFuzzer picks up anything placed in this section and uses it as
+// feedback next to the compiler inserted edge coverage, so inputs reaching new PCs or new opcode
+// forms are kept in the corpus even when they run through the same switch cases.
+#ifdef __linux__
+#define FUZZ_COUNTERS __attribute__((used, section("__libfuzzer_extra_counters")))
+#else
+#define FUZZ_COUNTERS
+#endif
+
+static chip8_machine chip8; // reset in place for every input
+static chip8_machine power_on; // what chip8 is reset to, loaded with an empty ROM
+
+// what the last input changed in RAM: its ROM and the RAM_GUARD bytes from I of every instruction
+// that wrote RAM, the most any instruction writes
+static size_t loaded_size;
+static uint16_t written[FUZZ_INSTRUCTION_BUDGET];
+static int written_count;
+
+FUZZ_COUNTERS static uint8_t pc_coverage[RAM_SIZE / 2]; // one counter per instruction slot
+FUZZ_COUNTERS static uint8_t opcode_coverage[16 * 256]; // first nibble + low byte (covers 8XYN, EXNN, FXNN, 00NN)
+
+_Static_assert(offsetof(chip8_machine, ram) == 0, "reset_machine() copies everything after ram in one go");
+
+// put chip8 back into the power-on state and load the ROM, like load_rom() but without clearing all
+// 64kb of RAM: only the parts the last input changed are restored
+static void reset_machine(const uint8_t *rom, size_t size)
+{
+    memcpy(&chip8.ram[BEGIN_LOCATION], &power_on.ram[BEGIN_LOCATION], loaded_size);
+    for (int i = 0; i < written_count; i++)
+    {
+        memcpy(&chip8.ram[written[i]], &power_on.ram[written[i]], RAM_GUARD);
+    }
+    memcpy(&chip8.display, &power_on.display, sizeof(chip8) - offsetof(chip8_machine, display));
+    memcpy(&chip8.ram[BEGIN_LOCATION], rom, size);
+    loaded_size = size;
+    written_count = 0;
+#ifdef FUZZ_STANDALONE
+    // replays are few, check the shortcut against a real load
+    static chip8_machine loaded;
+    load_rom(&loaded, rom, size);
+    loaded.rom_hash = chip8.rom_hash;
+    if (memcmp(&loaded, &chip8, sizeof(chip8)) != 0)
+    {
+        fprintf(stderr, "Partial reset differs from load_rom()\n");
+        abort();
+    }
+#endif
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < FUZZ_HEADER || size - FUZZ_HEADER > RAM_SIZE - BEGIN_LOCATION) // nothing to learn from it
+    {
+        return 0;
+    }
+    static bool initialised;
+    if (!initialised)
+    {
+        load_rom(&power_on, NULL, 0);
+        chip8 = power_on;
+        initialised = true;
+    }
+    uint16_t key_masks[FUZZ_KEY_MASKS];
+    for (int i = 0; i < FUZZ_KEY_MASKS; i++)
+    {
+        key_masks[i] = (uint16_t)(data[1 + 2 * i] | data[2 + 2 * i] << 8);
+    }
+    reset_machine(data + FUZZ_HEADER, size - FUZZ_HEADER);
+    seed_chip8(&chip8, 0); // keep CXNN deterministic so crashes reproduce
+    chip8.profile = data[0] % PROFILE_COUNT;
+    chip8.keys = key_masks[0];
+
+    instruction instr;
+    for (int i = 0; i < FUZZ_INSTRUCTION_BUDGET; i++)
+    {
+        pc_coverage[chip8.PC >> 1]++;
+
+        uint16_t I = chip8.I;
+        execute_instruction(&chip8, &instr);
+        opcode_coverage[((instr.opcode >> 12) << 8) | instr.NN]++;
+        if (chip8.ram_dirty)
+        {
+            written[written_count++] = I;
+            chip8.ram_dirty = false;
+        }
+
+        if ((i + 1) % FUZZ_INSTRUCTIONS_PER_FRAME == 0)
+        {
+            tick_timers(&chip8);
+            chip8.keys = key_masks[(i + 1) / FUZZ_INSTRUCTIONS_PER_FRAME % FUZZ_KEY_MASKS];
+        }
+    }
+    if (FUZZ_ABORT_ON_FAULT && chip8.fault != FAULT_NONE)
+    {
+        fprintf(stderr, "%s at %04X (%s profile)\n", fault_name(chip8.fault), chip8.fault_address,
+                profile_name(chip8.profile));
+        abort();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+// replay each file given on the command line through the harness
+int main(int argc, char **argv)
+{
+    static uint8_t buffer[65536];
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *file = fopen(argv[i], "rb");
+        if (!file)
+        {
+            fprintf(stderr, "Could not open %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        size_t size = fread(buffer, 1, sizeof(buffer), file);
+        fclose(file);
+
+        printf("Running %s (%zu bytes)\n", argv[i], size);
+        LLVMFuzzerTestOneInput(buffer, size);
+    }
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,185 @@
+// Per-opcode microbenchmarks for execute_instruction().
+//
+//   microbench [--iterations N] [--repeats N] [--profile NAME] [FILTER]
+//
+// Each case prepares the machine with a tiny program at BEGIN_LOCATION and executes it in a
+// tight loop, resetting PC, I, V0 and V1 before every pass, so FX55 and FX65 stay on the same
+// addresses under the profiles that increment I, and FX33/FX55 never overwrite the program. Reports ns per instruction as mean, standard
+// deviation and min over the repeats, so a dispatch or framebuffer change shows up per opcode
+// instead of only in the whole-ROM numbers of tools/bench.c. FILTER runs only the cases whose
+// name contains it. --profile picks the specialised interpreter that is measured (default chip8).
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define MICRO_DEFAULT_ITERATIONS 1000000
+#define MICRO_DEFAULT_REPEATS 15
+
+typedef struct {
+    const char *name;
+    uint16_t program[4]; // opcodes placed at BEGIN_LOCATION, 0 terminated
+    uint8_t steps; // instructions executed per pass
+    uint8_t vx, vy; // values loaded into V0 and V1 (the X and Y of every case)
+    uint16_t I;
+} micro_case;
+
+static const micro_case cases[] = {
+    {"00E0 clear", {0x00E0}, 1, 0, 0, 0},
+    {"1NNN jump", {0x1200}, 1, 0, 0, 0},
+    {"2NNN+00EE call/ret", {0x2202, 0x00EE}, 2, 0, 0, 0},
+    {"3XNN skip taken", {0x3012}, 1, 0x12, 0, 0},
+    {"3XNN skip not taken", {0x3012}, 1, 0x34, 0, 0},
+    {"5XY0 skip", {0x5010}, 1, 7, 7, 0},
+    {"6XNN load", {0x6042}, 1, 0, 0, 0},
+    {"7XNN add", {0x7042}, 1, 1, 0, 0},
+    {"8XY0 move", {0x8010}, 1, 1, 2, 0},
+    {"8XY1 or", {0x8011}, 1, 1, 2, 0},
+    {"8XY4 add no carry", {0x8014}, 1, 1, 2, 0},
+    {"8XY4 add carry", {0x8014}, 1, 0xF0, 0x20, 0},
+    {"8XY5 sub", {0x8015}, 1, 9, 3, 0},
+    {"8XY6 shift right", {0x8016}, 1, 9, 3, 0},
+    {"8XYE shift left", {0x801E}, 1, 9, 3, 0},
+    {"ANNN set I", {0xA300}, 1, 0, 0, 0},
+    {"BNNN jump+V0", {0xB200}, 1, 0, 0, 0},
+    {"CXNN random", {0xC0FF}, 1, 0, 0, 0},
+    {"DXY1 aligned", {0xD011}, 1, 8, 4, 0x0000},
+    {"DXY5 aligned", {0xD015}, 1, 8, 4, 0x0000},
+    {"DXY5 unaligned", {0xD015}, 1, 11, 4, 0x0000},
+    {"DXY5 wrap right", {0xD015}, 1, 61, 4, 0x0000},
+    {"DXY5 wrap bottom", {0xD015}, 1, 8, 30, 0x0000},
+    {"DXYF unaligned", {0xD01F}, 1, 11, 4, 0x0000},
+    {"DXY0 16x16", {0xD010}, 1, 11, 4, 0x0000},
+    {"00C4 scroll down", {0x00C4}, 1, 0, 0, 0},
+    {"00FB scroll right", {0x00FB}, 1, 0, 0, 0},
+    {"00FC scroll left", {0x00FC}, 1, 0, 0, 0},
+    {"EX9E key", {0xE09E}, 1, 5, 0, 0},
+    {"FX07 read delay", {0xF007}, 1, 0, 0, 0},
+    {"FX1E add I", {0xF01E}, 1, 3, 0, 0x300},
+    {"FX29 font", {0xF029}, 1, 0xA, 0, 0},
+    {"FX33 bcd", {0xF033}, 1, 0xFE, 0, 0x300},
+    {"FX55 store V0-VF", {0xFF55}, 1, 1, 2, 0x300},
+    {"FX65 load V0-VF", {0xFF65}, 1, 1, 2, 0x300},
+};
+
+static chip8_machine chip8;
+static quirk_profile profile = PROFILE_CHIP8;
+
+static void prepare(const micro_case *c)
+{
+    reset_chip8(&chip8);
+    for (int i = 0; i < 4 && c->program[i]; i++)
+    {
+        chip8.ram[BEGIN_LOCATION + i * 2] = c->program[i] >> 8;
+        chip8.ram[BEGIN_LOCATION + i * 2 + 1] = c->program[i] & 0xFF;
+    }
+    chip8.data_registers[0] = c->vx;
+    chip8.data_registers[1] = c->vy;
+    chip8.I = c->I;
+    seed_chip8(&chip8, 1);
+    chip8.profile = profile;
+}
+
+// returns ns per executed instruction for one repeat
+static double run_case(const micro_case *c, uint32_t iterations)
+{
+    instruction instr;
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        chip8.PC = BEGIN_LOCATION;
+        chip8.vblank = true; // so the VIP profile's DXYN draws instead of waiting for the next frame
+        for (int step = 0; step < c->steps; step++)
+        {
+            execute_instruction(&chip8, &instr);
+        }
+        // keep the state the case depends on from drifting (7XNN, 8XY4 ... modify V0, FX65 V0 and
+        // V1, FX55 and FX65 increment I under the chip8 profile)
+        chip8.data_registers[0] = c->vx;
+        chip8.data_registers[1] = c->vy;
+        chip8.I = c->I;
+    }
+    uint64_t elapsed = now_ns() - start;
+    return (double)elapsed / ((double)iterations * c->steps);
+}
+
+// whether the case's program is still in place, a case that overwrote it timed something else
+static bool program_intact(const micro_case *c)
+{
+    for (int i = 0; i < 4 && c->program[i]; i++)
+    {
+        if ((chip8.ram[BEGIN_LOCATION + i * 2] << 8 | chip8.ram[BEGIN_LOCATION + i * 2 + 1]) != c->program[i])
+        {
+            return false;
+        }
+    }
+    return !chip8.fault;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = MICRO_DEFAULT_ITERATIONS;
+    uint32_t repeats = MICRO_DEFAULT_REPEATS;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc)
+            repeats = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            if (!parse_profile(argv[++i], &profile))
+            {
+                fprintf(stderr, "Unknown profile %s (chip8, schip or xochip)\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] != '-')
+            filter = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s [--iterations N] [--repeats N] [--profile NAME] [FILTER]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (iterations == 0 || repeats == 0)
+    {
+        fprintf(stderr, "--iterations and --repeats must be at least 1\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-22s %10s %10s %10s\n", "case", "ns/op", "stddev", "min");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        if (filter && !strstr(cases[c].name, filter))
+        {
+            continue;
+        }
+
+        prepare(&cases[c]);
+        run_case(&cases[c], iterations / 10 + 1); // warm up caches and branch predictors
+
+        double sum = 0, sum_squares = 0, min = INFINITY;
+        for (uint32_t r = 0; r < repeats; r++)
+        {
+            prepare(&cases[c]);
+            double ns = run_case(&cases[c], iterations);
+            if (!program_intact(&cases[c]))
+            {
+                fprintf(stderr, "%s changed its own program or faulted, its timing is meaningless\n", cases[c].name);
+                return EXIT_FAILURE;
+            }
+            sum += ns;
+            sum_squares += ns * ns;
+            min = ns < min ? ns : min;
+        }
+        double mean = sum / repeats;
+        double variance = sum_squares / repeats - mean * mean;
+        printf("%-22s %10.2f %10.2f %10.2f\n", cases[c].name, mean, sqrt(variance > 0 ? variance : 0), min);
+    }
+    return EXIT_SUCCESS;
+}
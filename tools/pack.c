@@ -0,0 +1,238 @@
+// Packs ROMs into an archive (chip8_archive.h) and lists archives.
+//
+//   pack OUT.c8ra ROM...    pack the ROMs, - reads one ROM path per line from stdin instead
+//   pack --list ARCHIVE     print hash, size and name of every ROM in an archive
+//
+// ROMs are stored once by content: a file whose hash is already in the archive is skipped, so
+// packing a corpus full of renamed copies costs nothing extra. Names are stored without directories.
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "../chip8_archive.h"
+
+#define PACK_PATH_SIZE 4096
+
+typedef struct {
+    uint64_t rom_hash;
+    uint8_t *data;
+    uint32_t size;
+    char *name;
+} packed_rom;
+
+typedef struct {
+    packed_rom *roms;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t duplicates;
+} pack_list;
+
+static void put_le(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static int compare_roms(const void *a, const void *b)
+{
+    uint64_t hash_a = ((const packed_rom *)a)->rom_hash, hash_b = ((const packed_rom *)b)->rom_hash;
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+static bool add_rom(pack_list *list, const char *path)
+{
+    size_t size;
+    uint8_t *data = read_file(path, &size);
+    if (!data)
+    {
+        fprintf(stderr, "Could not read %s\n", path);
+        return false;
+    }
+    if (size > RAM_SIZE - BEGIN_LOCATION)
+    {
+        fprintf(stderr, "%s does not fit in memory, skipped\n", path);
+        free(data);
+        return true;
+    }
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        packed_rom *grown = realloc(list->roms, list->capacity * sizeof(packed_rom));
+        if (!grown)
+        {
+            fprintf(stderr, "Out of memory\n");
+            free(data);
+            return false;
+        }
+        list->roms = grown;
+    }
+    const char *name = path;
+    for (const char *c = path; *c; c++)
+    {
+        if (*c == '/' || *c == '\\')
+        {
+            name = c + 1;
+        }
+    }
+    packed_rom *rom = &list->roms[list->count++];
+    rom->rom_hash = fnv1a64(data, size); // same hash as chip8_machine.rom_hash
+    rom->data = data;
+    rom->size = (uint32_t)size;
+    rom->name = malloc(strlen(name) + 1);
+    if (!rom->name)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+    strcpy(rom->name, name);
+    return true;
+}
+
+// sort by hash and keep the first file of every hash
+static void drop_duplicates(pack_list *list)
+{
+    qsort(list->roms, list->count, sizeof(packed_rom), compare_roms);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        if (kept > 0 && list->roms[i].rom_hash == list->roms[kept - 1].rom_hash)
+        {
+            free(list->roms[i].data);
+            free(list->roms[i].name);
+            list->duplicates++;
+            continue;
+        }
+        list->roms[kept++] = list->roms[i];
+    }
+    list->count = kept;
+}
+
+static bool write_archive(const char *path, const pack_list *list)
+{
+    FILE *out = fopen(path, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Could not create %s\n", path);
+        return false;
+    }
+    bool ok = true;
+    uint8_t header[ARCHIVE_HEADER_SIZE] = ARCHIVE_MAGIC;
+    put_le(&header[4], ARCHIVE_VERSION, 4);
+    put_le(&header[8], list->count, 4);
+    ok &= fwrite(header, sizeof(header), 1, out) == 1;
+
+    // names right after the index, then the ROM data
+    uint64_t name_offset = ARCHIVE_HEADER_SIZE + (uint64_t)list->count * ARCHIVE_ENTRY_SIZE;
+    uint64_t data_offset = name_offset;
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        data_offset += strlen(list->roms[i].name) + 1;
+    }
+    if (data_offset > UINT32_MAX)
+    {
+        fprintf(stderr, "Too many ROM names for one archive\n");
+        fclose(out);
+        return false;
+    }
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        uint8_t entry[ARCHIVE_ENTRY_SIZE];
+        put_le(&entry[0], list->roms[i].rom_hash, 8);
+        put_le(&entry[8], data_offset, 8);
+        put_le(&entry[16], list->roms[i].size, 4);
+        put_le(&entry[20], name_offset, 4);
+        ok &= fwrite(entry, sizeof(entry), 1, out) == 1;
+        name_offset += strlen(list->roms[i].name) + 1;
+        data_offset += list->roms[i].size;
+    }
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        ok &= fwrite(list->roms[i].name, strlen(list->roms[i].name) + 1, 1, out) == 1;
+    }
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        ok &= list->roms[i].size == 0 || fwrite(list->roms[i].data, list->roms[i].size, 1, out) == 1;
+    }
+    ok &= fclose(out) == 0;
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write %s\n", path);
+    }
+    return ok;
+}
+
+static int pack_roms(const char *out_path, int count, char **paths)
+{
+    pack_list list = {0};
+    bool ok = true;
+    for (int i = 0; ok && i < count; i++)
+    {
+        if (strcmp(paths[i], "-") != 0)
+        {
+            ok = add_rom(&list, paths[i]);
+            continue;
+        }
+        char line[PACK_PATH_SIZE];
+        while (ok && fgets(line, sizeof(line), stdin))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0])
+            {
+                ok = add_rom(&list, line);
+            }
+        }
+    }
+    if (ok)
+    {
+        drop_duplicates(&list);
+        ok = write_archive(out_path, &list);
+    }
+    if (ok)
+    {
+        printf("%s: %u ROMs (%u duplicates skipped)\n", out_path, list.count, list.duplicates);
+    }
+    for (uint32_t i = 0; i < list.count; i++)
+    {
+        free(list.roms[i].data);
+        free(list.roms[i].name);
+    }
+    free(list.roms);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int list_archive(const char *path)
+{
+    rom_archive archive;
+    if (!open_archive(&archive, path))
+    {
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < archive.count; i++)
+    {
+        archive_rom rom;
+        get_archive_rom(&archive, i, &rom);
+        printf("%016" PRIX64 " %6u %s\n", rom.rom_hash, rom.size, rom.name);
+    }
+    close_archive(&archive);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "--list") == 0)
+    {
+        return list_archive(argv[2]);
+    }
+    if (argc >= 3 && argv[1][0] != '-')
+    {
+        return pack_roms(argv[1], argc - 2, &argv[2]);
+    }
+
+    fprintf(stderr, "usage: %s OUT.c8ra ROM... (- reads paths from stdin)\n"
+                    "       %s --list ARCHIVE\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
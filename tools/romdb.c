@@ -0,0 +1,206 @@
+// Builds and queries the ROM database (chip8_romdb.h).
+//
+//   romdb build LIST.txt OUT.romdb   compile a text list of ROMs into a database
+//   romdb hash ROM...                print a list line for each ROM, to fill in and add to the list
+//   romdb lookup DB ROM...           print the settings the database has for each ROM
+//
+// The list has one ROM per line, '#' starts a comment:
+//   HASH PLATFORM PROFILE IPF KEYMAP TITLE
+// HASH is chip8_machine.rom_hash in hex, PLATFORM and PROFILE are chip8, schip or xochip, IPF is
+// the instructions per frame, KEYMAP is a 16 key --keymap string or - for the default layout, and
+// the rest of the line is the title.
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "../chip8_romdb.h"
+
+#define ROMDB_LINE_SIZE 256
+
+// parse one list line into info, returns false for a malformed line
+static bool parse_line(char *line, rom_info *info)
+{
+    char *fields[5];
+    char *rest = line;
+    for (int i = 0; i < 5; i++)
+    {
+        fields[i] = strtok_r(rest, " \t\r\n", &rest);
+        if (!fields[i])
+        {
+            return false;
+        }
+    }
+    rest += strspn(rest, " \t");
+    rest[strcspn(rest, "\r\n")] = '\0';
+
+    char *end;
+    info->rom_hash = strtoull(fields[0], &end, 16);
+    if (*end != '\0')
+    {
+        return false;
+    }
+    quirk_profile platform, profile;
+    if (!parse_profile(fields[1], &platform) || !parse_profile(fields[2], &profile))
+    {
+        return false;
+    }
+    info->platform = platform;
+    info->profile = profile;
+    unsigned long ipf = strtoul(fields[3], &end, 10);
+    if (*end != '\0' || ipf == 0 || ipf > UINT16_MAX)
+    {
+        return false;
+    }
+    info->instructions_per_frame = (uint16_t)ipf;
+    if (strcmp(fields[4], "-") == 0)
+    {
+        info->keymap[0] = '\0';
+    }
+    else if (strlen(fields[4]) == 16)
+    {
+        memcpy(info->keymap, fields[4], 17);
+    }
+    else
+    {
+        return false;
+    }
+    snprintf(info->title, sizeof(info->title), "%s", rest);
+    return true;
+}
+
+static int build_romdb(const char *list_path, const char *db_path)
+{
+    FILE *list = fopen(list_path, "r");
+    if (!list)
+    {
+        fprintf(stderr, "Could not open %s\n", list_path);
+        return EXIT_FAILURE;
+    }
+    rom_info *roms = NULL;
+    uint32_t count = 0, capacity = 0;
+    char line[ROMDB_LINE_SIZE];
+    int line_number = 0;
+    int status = EXIT_SUCCESS;
+    while (fgets(line, sizeof(line), list))
+    {
+        line_number++;
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0')
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            rom_info *grown = realloc(roms, capacity * sizeof(rom_info));
+            if (!grown)
+            {
+                fprintf(stderr, "Out of memory\n");
+                status = EXIT_FAILURE;
+                break;
+            }
+            roms = grown;
+        }
+        if (!parse_line(text, &roms[count]))
+        {
+            fprintf(stderr, "%s:%d: expected HASH PLATFORM PROFILE IPF KEYMAP TITLE\n", list_path, line_number);
+            status = EXIT_FAILURE;
+            break;
+        }
+        count++;
+    }
+    fclose(list);
+
+    if (status == EXIT_SUCCESS && !write_romdb(db_path, roms, count))
+    {
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS)
+    {
+        printf("%s: %u ROMs\n", db_path, count);
+    }
+    free(roms);
+    return status;
+}
+
+static bool load_file(chip8_machine *chip8, const char *path)
+{
+    size_t size;
+    uint8_t *rom = read_file(path, &size);
+    bool loaded = rom && load_rom(chip8, rom, size);
+    free(rom);
+    if (!loaded)
+    {
+        fprintf(stderr, "Could not load ROM %s\n", path);
+    }
+    return loaded;
+}
+
+static int hash_roms(int count, char **paths)
+{
+    static chip8_machine chip8;
+    for (int i = 0; i < count; i++)
+    {
+        if (!load_file(&chip8, paths[i]))
+        {
+            return EXIT_FAILURE;
+        }
+        printf("%016" PRIX64 " chip8 chip8 %d - %s\n", chip8.rom_hash, INSTRUCTIONS_PER_FRAME, paths[i]);
+    }
+    return EXIT_SUCCESS;
+}
+
+static int lookup_roms(const char *db_path, int count, char **paths)
+{
+    static chip8_machine chip8;
+    romdb db;
+    if (!open_romdb(&db, db_path))
+    {
+        fprintf(stderr, "Could not open %s\n", db_path);
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_SUCCESS;
+    for (int i = 0; i < count; i++)
+    {
+        rom_info info;
+        if (!load_file(&chip8, paths[i]))
+        {
+            status = EXIT_FAILURE;
+        }
+        else if (find_rom(&db, chip8.rom_hash, &info))
+        {
+            printf("%s: \"%s\", %s ROM, %s quirks, %u instructions per frame, keymap %s\n", paths[i], info.title,
+                   profile_name(info.platform), profile_name(info.profile), info.instructions_per_frame,
+                   info.keymap[0] ? info.keymap : "default");
+        }
+        else
+        {
+            printf("%s: unknown ROM %016" PRIX64 "\n", paths[i], chip8.rom_hash);
+        }
+    }
+    close_romdb(&db);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && strcmp(argv[1], "build") == 0)
+    {
+        return build_romdb(argv[2], argv[3]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "hash") == 0)
+    {
+        return hash_roms(argc - 2, &argv[2]);
+    }
+    if (argc >= 4 && strcmp(argv[1], "lookup") == 0)
+    {
+        return lookup_roms(argv[2], argc - 3, &argv[3]);
+    }
+
+    fprintf(stderr, "usage: %s build LIST.txt OUT.romdb\n"
+                    "       %s hash ROM...\n"
+                    "       %s lookup DB ROM...\n", argv[0], argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,211 @@
+// Environment server: hosts batched environments (chip8_env.h) for trainers running in other
+// processes, which step them through shared memory (chip8_shm.h) instead of pipes or sockets.
+//
+//   serve NAME ROM [--count N] [--ipf N] [--seed N] [--profile NAME] [--romdb DB] [--max-frames N]
+//         [--hang-frames K] [--reward ADDR:BYTES] [--lockstep]
+//   serve --bench NAME [--steps N] [--frames-per-step N]
+//
+// NAME is the shared memory region, such as /chip8-pong (it shows up in /dev/shm next to
+// NAME-machines). The server runs until a client sends SHM_QUIT, or until SIGINT or SIGTERM, and
+// removes the regions when it stops. Regions a crashed server left under NAME are removed at the start.
+// ROMs found in the ROM database get its profile and speed unless --profile or --ipf say otherwise.
+// --reward makes the change of the big endian number at ADDR (hex) the reward, --lockstep steps the
+// machines with run_frame_lockstep(). --bench is a client: it steps a running server with
+// scripted_keys() as every machine's input and prints how fast that went. Linux only.
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "../chip8_env.h"
+#include "../chip8_romdb.h"
+#include "../chip8_shm.h"
+
+#define SERVE_DEFAULT_COUNT 256
+#define SERVE_WAIT_MS 200 // longest the server sleeps before looking at the stop flag
+#define BENCH_DEFAULT_STEPS 1000
+
+static volatile sig_atomic_t stop;
+
+static void request_stop(int signal_number)
+{
+    (void)signal_number;
+    stop = 1;
+}
+
+// step the server at name and print steps and frames per second
+static int bench(const char *name, unsigned long steps, unsigned int frames_per_step)
+{
+    shm_env shm;
+    if (!open_shm_client(&shm, name))
+    {
+        return EXIT_FAILURE;
+    }
+    if (!call_shm(&shm, SHM_RESET, 0))
+    {
+        close_shm_client(&shm);
+        return EXIT_FAILURE;
+    }
+    unsigned long episodes = 0;
+    uint64_t start = now_ns();
+    unsigned long step = 0;
+    for (; step < steps && !stop; step++)
+    {
+        for (uint32_t i = 0; i < shm.count; i++)
+        {
+            shm.actions[i] = scripted_keys((uint32_t)(step * frames_per_step + i));
+        }
+        if (!call_shm(&shm, SHM_STEP, frames_per_step))
+        {
+            close_shm_client(&shm);
+            return EXIT_FAILURE;
+        }
+        for (uint32_t i = 0; i < shm.count; i++)
+        {
+            episodes += shm.done[i];
+        }
+    }
+    double seconds = (double)(now_ns() - start) / 1e9;
+    printf("%s: %lu steps of %u machines x %u frames in %.3fs, %.0f steps/s, %.0f frames/s, %lu episodes ended\n",
+           name, step, shm.count, frames_per_step, seconds, (double)step / seconds,
+           (double)step * shm.count * frames_per_step / seconds, episodes);
+    close_shm_client(&shm);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    const char *usage = "usage: %s NAME ROM [--count N] [--ipf N] [--seed N] [--profile NAME] [--romdb DB] "
+                        "[--max-frames N] [--hang-frames K] [--reward ADDR:BYTES] [--lockstep]\n"
+                        "       %s --bench NAME [--steps N] [--frames-per-step N]\n";
+    struct sigaction action = {.sa_handler = request_stop}; // no SA_RESTART: a signal cuts waits short
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (argc >= 3 && strcmp(argv[1], "--bench") == 0)
+    {
+        unsigned long steps = BENCH_DEFAULT_STEPS;
+        unsigned int frames_per_step = 4;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+                steps = strtoul(argv[++i], NULL, 10);
+            else if (strcmp(argv[i], "--frames-per-step") == 0 && i + 1 < argc)
+                frames_per_step = (unsigned int)strtoul(argv[++i], NULL, 10);
+            else
+            {
+                fprintf(stderr, usage, argv[0], argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        return bench(argv[2], steps, frames_per_step);
+    }
+    if (argc < 3)
+    {
+        fprintf(stderr, usage, argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *name = argv[1];
+    uint32_t count = SERVE_DEFAULT_COUNT;
+    env_config config = {.profile = PROFILE_CHIP8, .instructions_per_frame = INSTRUCTIONS_PER_FRAME,
+                         .seed = DEFAULT_SEED, .planes = 1};
+    bool profile_set = false, ipf_set = false;
+    const char *romdb_path = NULL;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc)
+        {
+            config.instructions_per_frame = (unsigned int)strtoul(argv[++i], NULL, 10);
+            ipf_set = true;
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            config.seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profile_set = parse_profile(argv[++i], &config.profile);
+            if (!profile_set)
+            {
+                fprintf(stderr, "Unknown profile %s (chip8, schip or xochip)\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--romdb") == 0 && i + 1 < argc)
+            romdb_path = argv[++i];
+        else if (strcmp(argv[i], "--max-frames") == 0 && i + 1 < argc)
+            config.max_frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--hang-frames") == 0 && i + 1 < argc)
+            config.hang_frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--reward") == 0 && i + 1 < argc)
+        {
+            unsigned int address, bytes;
+            if (sscanf(argv[++i], "%x:%u", &address, &bytes) != 2 || address > 0xFFFF)
+            {
+                fprintf(stderr, "--reward takes a hex address and a byte count, such as 1F0:2\n");
+                return EXIT_FAILURE;
+            }
+            config.reward_address = (uint16_t)address;
+            config.reward_bytes = (uint8_t)(bytes > 255 ? 255 : bytes); // create_envs() checks the range
+        }
+        else if (strcmp(argv[i], "--lockstep") == 0)
+            config.lockstep = true;
+        else
+        {
+            fprintf(stderr, usage, argv[0], argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t rom_size;
+    uint8_t *rom = read_file(argv[2], &rom_size);
+    if (!rom)
+    {
+        fprintf(stderr, "Could not read %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    // settings of a known ROM, looked up by the hash load_rom() gives it
+    static chip8_machine probe; // static, the machine is a few kilobytes
+    romdb db;
+    if (load_rom(&probe, rom, rom_size) && open_romdb(&db, romdb_path ? romdb_path : DEFAULT_ROMDB))
+    {
+        rom_info info;
+        if (find_rom(&db, probe.rom_hash, &info))
+        {
+            config.profile = profile_set ? config.profile : (quirk_profile)info.profile;
+            config.instructions_per_frame = ipf_set ? config.instructions_per_frame : info.instructions_per_frame;
+        }
+        close_romdb(&db);
+    }
+    else if (romdb_path)
+    {
+        fprintf(stderr, "Could not open ROM database %s\n", romdb_path);
+        free(rom);
+        return EXIT_FAILURE;
+    }
+
+    shm_env shm;
+    chip8_envs envs;
+    bool created = create_shm_server(&shm, &envs, name, count, rom, rom_size, &config);
+    free(rom);
+    if (!created)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("Serving %u machines of %s (%s, %u instructions per frame%s) at %s\n", count, argv[2],
+           profile_name(config.profile), config.instructions_per_frame, config.lockstep ? ", lockstep" : "", name);
+    fflush(stdout);
+
+    unsigned long requests = 0;
+    shm_command command = SHM_IDLE;
+    while (!stop && command != SHM_QUIT)
+    {
+        command = serve_shm(&shm, &envs, SERVE_WAIT_MS);
+        requests += command != SHM_IDLE;
+    }
+    destroy_shm_server(&shm, &envs);
+    printf("%s: served %lu requests\n", name, requests);
+    return EXIT_SUCCESS;
+}
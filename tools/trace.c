@@ -0,0 +1,387 @@
+// Golden-trace differential runner.
+//
+//   trace record ROM OUT.trace [FRAMES] [PROFILE]   record the machine state after every instruction
+//   trace verify ROM GOLDEN.trace                   replay the ROM and stop at the first instruction that differs
+//
+// Runs are headless and deterministic: fixed RNG seed, scripted_keys() as input and
+// INSTRUCTIONS_PER_FRAME instructions between timer ticks, under the quirk profile stored in the trace
+// (chip8 unless given). Record goldens with a known-good build
+// (make golden), then check every change to execute_instruction() against them (make trace-check).
+// Trace files are little endian on every host and the framebuffer hash is taken over its pixels in
+// order, so the goldens in traces/ hold on any machine.
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+#define TRACE_MAGIC 0x52543843u // "C8TR"
+#define TRACE_VERSION 6 // 2: CXNN uses the per-machine RNG instead of rand(), 3: packed SUPER-CHIP display, 4: XO-CHIP planes,
+                         // 5: quirk profiles, VF written last by 8XYN, FX33 converts VX, 6: little endian records
+#define TRACE_DEFAULT_FRAMES 600 // 10 seconds of emulated time
+#define TRACE_SEED 1
+
+// header and records as stored: little endian fields in this order, no padding
+#define TRACE_HEADER_SIZE 32
+#define TRACE_RECORD_SIZE 33
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frames;
+    uint32_t instructions_per_frame;
+    uint32_t seed;
+    uint32_t profile;
+    uint64_t rom_hash;
+} trace_header;
+
+// machine state after one instruction
+typedef struct {
+    uint64_t display_hash;
+    uint16_t pc; // address the instruction was fetched from
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t V[16];
+} trace_record;
+
+static uint8_t *put_le(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        *out++ = (uint8_t)(value >> (8 * i));
+    }
+    return out;
+}
+
+static uint64_t get_le(const uint8_t **in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)(*in)[i] << (8 * i);
+    }
+    *in += bytes;
+    return value;
+}
+
+static void encode_header(const trace_header *header, uint8_t out[TRACE_HEADER_SIZE])
+{
+    out = put_le(out, header->magic, 4);
+    out = put_le(out, header->version, 4);
+    out = put_le(out, header->frames, 4);
+    out = put_le(out, header->instructions_per_frame, 4);
+    out = put_le(out, header->seed, 4);
+    out = put_le(out, header->profile, 4);
+    put_le(out, header->rom_hash, 8);
+}
+
+static void decode_header(const uint8_t in[TRACE_HEADER_SIZE], trace_header *header)
+{
+    header->magic = (uint32_t)get_le(&in, 4);
+    header->version = (uint32_t)get_le(&in, 4);
+    header->frames = (uint32_t)get_le(&in, 4);
+    header->instructions_per_frame = (uint32_t)get_le(&in, 4);
+    header->seed = (uint32_t)get_le(&in, 4);
+    header->profile = (uint32_t)get_le(&in, 4);
+    header->rom_hash = get_le(&in, 8);
+}
+
+static void encode_record(const trace_record *record, uint8_t out[TRACE_RECORD_SIZE])
+{
+    out = put_le(out, record->display_hash, 8);
+    out = put_le(out, record->pc, 2);
+    out = put_le(out, record->opcode, 2);
+    out = put_le(out, record->I, 2);
+    out = put_le(out, record->sp, 1);
+    out = put_le(out, record->delay_timer, 1);
+    out = put_le(out, record->sound_timer, 1);
+    memcpy(out, record->V, sizeof(record->V));
+}
+
+static void decode_record(const uint8_t in[TRACE_RECORD_SIZE], trace_record *record)
+{
+    record->display_hash = get_le(&in, 8);
+    record->pc = (uint16_t)get_le(&in, 2);
+    record->opcode = (uint16_t)get_le(&in, 2);
+    record->I = (uint16_t)get_le(&in, 2);
+    record->sp = (uint8_t)get_le(&in, 1);
+    record->delay_timer = (uint8_t)get_le(&in, 1);
+    record->sound_timer = (uint8_t)get_le(&in, 1);
+    memcpy(record->V, in, sizeof(record->V));
+}
+
+// FNV-1a of the framebuffer pixels in order: every display word most significant byte first, the
+// same on any host, plus the mode
+static uint64_t hash_display(const chip8_machine *chip8)
+{
+    const uint64_t *words = &chip8->display[0][0][0];
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < sizeof(chip8->display) / sizeof(uint64_t); i++)
+    {
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            hash ^= (uint8_t)(words[i] >> shift);
+            hash *= 0x100000001B3ULL;
+        }
+    }
+    return hash ^ chip8->hires;
+}
+
+typedef struct {
+    chip8_machine chip8;
+    uint8_t *rom;
+    size_t rom_size;
+    uint32_t frame;
+    uint32_t step; // instruction within the frame
+    uint64_t display_hash;
+    instruction instr;
+} trace_run;
+
+static bool start_run(trace_run *run, const char *rom_path, uint32_t seed, quirk_profile profile)
+{
+    run->rom = read_file(rom_path, &run->rom_size);
+    if (!run->rom || !load_rom(&run->chip8, run->rom, run->rom_size))
+    {
+        fprintf(stderr, "Could not load ROM %s\n", rom_path);
+        return false;
+    }
+    seed_chip8(&run->chip8, seed);
+    run->chip8.profile = profile;
+    run->frame = 0;
+    run->step = 0;
+    run->display_hash = hash_display(&run->chip8);
+    apply_keys(&run->chip8, scripted_keys(0));
+    return true;
+}
+
+// execute the next instruction and capture the resulting state
+static void step_run(trace_run *run, trace_record *record)
+{
+    chip8_machine *chip8 = &run->chip8;
+    memset(record, 0, sizeof(*record));
+    record->pc = chip8->PC;
+
+    execute_instruction(chip8, &run->instr);
+
+    // only rehash the display after instructions that touched it
+    if (chip8->display_dirty)
+    {
+        run->display_hash = hash_display(chip8);
+        chip8->display_dirty = false;
+    }
+
+    record->display_hash = run->display_hash;
+    record->opcode = run->instr.opcode;
+    record->I = chip8->I;
+    record->sp = chip8->cur_stack;
+    record->delay_timer = chip8->delay_timer;
+    record->sound_timer = chip8->sound_timer;
+    memcpy(record->V, chip8->data_registers, sizeof(record->V));
+
+    if (++run->step == INSTRUCTIONS_PER_FRAME)
+    {
+        tick_timers(chip8);
+        run->step = 0;
+        run->frame++;
+        apply_keys(chip8, scripted_keys(run->frame));
+    }
+}
+
+static int record_trace(const char *rom_path, const char *trace_path, uint32_t frames, quirk_profile profile)
+{
+    static trace_run run;
+    if (!start_run(&run, rom_path, TRACE_SEED, profile))
+    {
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = fopen(trace_path, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Could not create %s\n", trace_path);
+        return EXIT_FAILURE;
+    }
+
+    trace_header header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .frames = frames,
+        .instructions_per_frame = INSTRUCTIONS_PER_FRAME,
+        .seed = TRACE_SEED,
+        .profile = profile,
+        .rom_hash = fnv1a64(run.rom, run.rom_size),
+    };
+    uint8_t bytes[TRACE_HEADER_SIZE];
+    encode_header(&header, bytes);
+    fwrite(bytes, sizeof(bytes), 1, out);
+
+    trace_record record;
+    uint64_t total = (uint64_t)frames * INSTRUCTIONS_PER_FRAME;
+    for (uint64_t i = 0; i < total; i++)
+    {
+        uint8_t encoded[TRACE_RECORD_SIZE];
+        step_run(&run, &record);
+        encode_record(&record, encoded);
+        fwrite(encoded, sizeof(encoded), 1, out);
+    }
+
+    free(run.rom);
+    if (fclose(out) != 0)
+    {
+        fprintf(stderr, "Could not write %s\n", trace_path);
+        return EXIT_FAILURE;
+    }
+    printf("%s: recorded %" PRIu64 " instructions (%u frames, %s)\n", rom_path, total, frames, profile_name(profile));
+    return EXIT_SUCCESS;
+}
+
+static void print_row(const char *name, uint64_t expected, uint64_t actual, int width)
+{
+    printf("  %-6s %0*" PRIX64 "%*s  %0*" PRIX64 "%*s%s\n", name,
+           width, expected, 16 - width, "", width, actual, 16 - width, "", expected != actual ? "  <--" : "");
+}
+
+static void print_diff(const trace_record *expected, const trace_record *actual)
+{
+    printf("  %-6s %-16s  %-16s\n", "field", "expected", "actual");
+    print_row("PC", expected->pc, actual->pc, 4);
+    print_row("opcode", expected->opcode, actual->opcode, 4);
+    print_row("I", expected->I, actual->I, 4);
+    print_row("SP", expected->sp, actual->sp, 2);
+    print_row("DT", expected->delay_timer, actual->delay_timer, 2);
+    print_row("ST", expected->sound_timer, actual->sound_timer, 2);
+    for (int i = 0; i < 16; i++)
+    {
+        char name[4];
+        snprintf(name, sizeof(name), "V%X", i);
+        print_row(name, expected->V[i], actual->V[i], 2);
+    }
+    print_row("fb", expected->display_hash, actual->display_hash, 16);
+}
+
+static int verify_trace(const char *rom_path, const char *trace_path)
+{
+    FILE *golden = fopen(trace_path, "rb");
+    if (!golden)
+    {
+        fprintf(stderr, "Could not open %s\n", trace_path);
+        return EXIT_FAILURE;
+    }
+
+    trace_header header;
+    uint8_t bytes[TRACE_HEADER_SIZE];
+    bool complete = fread(bytes, sizeof(bytes), 1, golden) == 1;
+    if (complete)
+    {
+        decode_header(bytes, &header);
+    }
+    if (!complete || header.magic != TRACE_MAGIC)
+    {
+        fprintf(stderr, "%s is not a trace file\n", trace_path);
+        fclose(golden);
+        return EXIT_FAILURE;
+    }
+    if (header.version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s is a version %u trace, this build writes version %u (re-record it with make golden)\n",
+                trace_path, header.version, TRACE_VERSION);
+        fclose(golden);
+        return EXIT_FAILURE;
+    }
+    if (header.instructions_per_frame != INSTRUCTIONS_PER_FRAME)
+    {
+        fprintf(stderr, "%s was recorded with %u instructions per frame, this build runs %u\n",
+                trace_path, header.instructions_per_frame, INSTRUCTIONS_PER_FRAME);
+        fclose(golden);
+        return EXIT_FAILURE;
+    }
+
+    if (header.profile >= PROFILE_COUNT)
+    {
+        fprintf(stderr, "%s was recorded with an unknown quirk profile (%u)\n", trace_path, header.profile);
+        fclose(golden);
+        return EXIT_FAILURE;
+    }
+
+    static trace_run run;
+    if (!start_run(&run, rom_path, header.seed, (quirk_profile)header.profile))
+    {
+        fclose(golden);
+        return EXIT_FAILURE;
+    }
+    if (fnv1a64(run.rom, run.rom_size) != header.rom_hash)
+    {
+        fprintf(stderr, "%s was recorded from a different ROM than %s\n", trace_path, rom_path);
+        free(run.rom);
+        fclose(golden);
+        return EXIT_FAILURE;
+    }
+
+    // stream both sides, one record at a time, so long traces don't need to fit in memory
+    trace_record expected, actual, previous = {0};
+    uint8_t golden_bytes[TRACE_RECORD_SIZE], actual_bytes[TRACE_RECORD_SIZE];
+    uint64_t count = 0;
+    uint64_t total = (uint64_t)header.frames * header.instructions_per_frame;
+    int status = EXIT_SUCCESS;
+    while (count < total && fread(golden_bytes, sizeof(golden_bytes), 1, golden) == 1)
+    {
+        uint32_t frame = run.frame;
+        step_run(&run, &actual);
+        encode_record(&actual, actual_bytes);
+        if (memcmp(golden_bytes, actual_bytes, sizeof(golden_bytes)) != 0)
+        {
+            decode_record(golden_bytes, &expected);
+            printf("%s: first divergence at instruction %" PRIu64 " (frame %u)\n", rom_path, count, frame);
+            if (count > 0)
+            {
+                printf("  previous instruction %04X at %04X matched\n", previous.opcode, previous.pc);
+            }
+            print_diff(&expected, &actual);
+            status = EXIT_FAILURE;
+            break;
+        }
+        previous = actual;
+        count++;
+    }
+
+    if (status == EXIT_SUCCESS && count < total)
+    {
+        printf("%s: %s is truncated, it ends after %" PRIu64 " of %" PRIu64 " instructions\n", rom_path, trace_path,
+               count, total);
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS)
+    {
+        printf("%s: %" PRIu64 " instructions match %s\n", rom_path, count, trace_path);
+    }
+    free(run.rom);
+    fclose(golden);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 4 && strcmp(argv[1], "record") == 0)
+    {
+        uint32_t frames = argc >= 5 ? (uint32_t)strtoul(argv[4], NULL, 10) : TRACE_DEFAULT_FRAMES;
+        quirk_profile profile = PROFILE_CHIP8;
+        if (argc >= 6 && !parse_profile(argv[5], &profile))
+        {
+            fprintf(stderr, "Unknown profile %s (chip8, schip or xochip)\n", argv[5]);
+            return EXIT_FAILURE;
+        }
+        return record_trace(argv[2], argv[3], frames, profile);
+    }
+    if (argc >= 4 && strcmp(argv[1], "verify") == 0)
+    {
+        return verify_trace(argv[2], argv[3]);
+    }
+
+    fprintf(stderr, "usage: %s record ROM OUT.trace [FRAMES] [PROFILE]\n"
+                    "       %s verify ROM GOLDEN.trace\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
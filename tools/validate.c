@@ -0,0 +1,529 @@
+// Batch ROM validation: runs every ROM of a collection headless, in parallel, and prints a table
+// of how each one ended.
+//
+//   validate [--frames N] [--jobs N] [--hang-frames K] [--profile NAME] [--romdb DB] [--problems] DIR|ARCHIVE|ROM...
+//
+// Every ROM runs for a budget of N frames (default 600) with scripted_keys() as input, with its
+// quirk profile and speed from the ROM database unless --profile is given, and is retired early
+// once it exits, faults or hangs (chip8_hang.h, --hang-frames 0 turns that off). Stack overflows
+// and underflows and accesses past the end of RAM are recorded as faults (chip8_machine.fault),
+// which end the run and are reported like any other outcome. On top of that every ROM runs in a worker process: a worker that dies
+// anyway takes down only the ROM it was running, which is reported as crashed, and a new worker
+// carries on with the rest. Results go straight into memory shared with the workers.
+//
+// Arguments are directories (every file in them), ROM archives made by tools/pack.c (.c8ra) or
+// single ROMs, at most 64 archives. RAM is 64kb under every profile, so a CHIP-8 or SUPER-CHIP ROM
+// that reads or writes from I past the 4kb those machines have is only warned about, with the
+// first instruction that did. --problems leaves out the ROMs that ran or ended cleanly without
+// warnings. The exit status is 1 if any ROM faulted, crashed or could not be loaded. POSIX only (fork).
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "../chip8_archive.h"
+#include "../chip8_hang.h"
+#include "../chip8_romdb.h"
+
+#define VALIDATE_DEFAULT_FRAMES 600
+#define VALIDATE_MAX_JOBS 256
+#define VALIDATE_MAX_ARCHIVES 64
+#define SMALL_RAM_SIZE 0x1000 // what CHIP-8 and SUPER-CHIP programs can address
+
+typedef enum {
+    STATE_PENDING,
+    STATE_RUNNING,
+    STATE_DONE,
+} rom_state;
+
+typedef enum {
+    OUTCOME_RAN, // still making progress when the frame budget ran out
+    OUTCOME_ENDED, // hang_kind in detail: exited, self-jump, waiting for key, stuck loop
+    OUTCOME_FAULT, // chip8_fault in detail
+    OUTCOME_CRASHED, // the worker died, signal number in detail (0: exited without a result)
+    OUTCOME_UNLOADABLE, // unreadable, or too large for RAM
+} rom_outcome;
+
+typedef struct {
+    const char *name;
+    const char *path; // NULL for a ROM in an archive
+    const uint8_t *data; // archive ROMs: in the mapping, which workers inherit
+    uint32_t size;
+} rom_source;
+
+// one per ROM, in memory shared between the parent and the workers
+typedef struct {
+    _Atomic uint32_t state; // rom_state
+    pid_t worker;
+    uint64_t rom_hash;
+    uint32_t frames;
+    uint16_t pc;
+    uint8_t profile;
+    uint8_t outcome;
+    uint8_t detail;
+    bool past_small_ram; // a chip8 or schip ROM accessed memory from I past SMALL_RAM_SIZE
+    uint16_t past_small_ram_pc; // the first instruction that did
+} rom_result;
+
+typedef struct {
+    _Atomic uint32_t next; // next ROM a worker picks up
+    rom_result results[];
+} shared_results;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t hang_frames;
+    bool profile_set;
+    quirk_profile profile;
+    romdb db;
+    bool has_db;
+} validate_settings;
+
+static rom_source *sources;
+static uint32_t source_count, source_capacity;
+
+static bool add_source(const char *name, const char *path, const uint8_t *data, uint32_t size)
+{
+    if (source_count == source_capacity)
+    {
+        source_capacity = source_capacity ? source_capacity * 2 : 1024;
+        rom_source *grown = realloc(sources, source_capacity * sizeof(rom_source));
+        if (!grown)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return false;
+        }
+        sources = grown;
+    }
+    sources[source_count++] = (rom_source){name, path, data, size};
+    return true;
+}
+
+// every regular file in a directory, not recursive
+static bool add_directory(const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+    {
+        fprintf(stderr, "Could not open directory %s\n", dir_path);
+        return false;
+    }
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        size_t length = strlen(dir_path) + strlen(entry->d_name) + 2;
+        char *path = malloc(length);
+        struct stat st;
+        if (!path)
+        {
+            fprintf(stderr, "Out of memory\n");
+            ok = false;
+            break;
+        }
+        snprintf(path, length, "%s/%s", dir_path, entry->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            free(path);
+            continue;
+        }
+        ok = add_source(path + strlen(dir_path) + 1, path, NULL, 0);
+    }
+    closedir(dir);
+    return ok;
+}
+
+static bool add_archive(const char *path, rom_archive *archive)
+{
+    if (!open_archive(archive, path))
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < archive->count; i++)
+    {
+        archive_rom rom;
+        get_archive_rom(archive, i, &rom);
+        if (!add_source(rom.name, NULL, rom.data, rom.size))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool has_suffix(const char *text, const char *suffix)
+{
+    size_t length = strlen(text), suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(text + length - suffix_length, suffix) == 0;
+}
+
+// bytes an instruction reads or writes from I, 0 for the ones that don't touch memory
+static unsigned int bytes_from_i(const instruction *instr)
+{
+    if (instr->opcode >> 12 == 0xD)
+    {
+        return instr->N ? instr->N : 32; // DXY0 is a 16 x 16 sprite
+    }
+    switch (instr->opcode & 0xF0FF)
+    {
+    case 0xF033:
+        return 3;
+    case 0xF055:
+    case 0xF065:
+        return instr->X + 1u;
+    default:
+        return 0;
+    }
+}
+
+// run_frame() one instruction at a time, noting the first access from I past the 4kb that CHIP-8
+// and SUPER-CHIP programs can address. RAM is 64kb under every profile, so the machine itself
+// doesn't fault on those
+static void run_small_ram_frame(chip8_machine *chip8, instruction *instr, unsigned int instructions, rom_result *result)
+{
+    for (unsigned int i = 0; i < instructions; i++)
+    {
+        uint16_t I = chip8->I, pc = chip8->PC;
+        execute_instruction(chip8, instr);
+        unsigned int bytes = bytes_from_i(instr);
+        if (bytes && I + bytes > SMALL_RAM_SIZE && !result->past_small_ram)
+        {
+            result->past_small_ram = true;
+            result->past_small_ram_pc = pc;
+        }
+    }
+    tick_timers(chip8);
+}
+
+// run one ROM to the end of its budget, or until it exits, faults or hangs
+static void run_rom(const validate_settings *settings, const rom_source *source, rom_result *result)
+{
+    static chip8_machine chip8;
+    bool loaded;
+    if (source->path)
+    {
+        size_t size;
+        uint8_t *rom = read_file(source->path, &size);
+        loaded = rom && load_rom(&chip8, rom, size);
+        free(rom);
+    }
+    else
+    {
+        loaded = load_rom(&chip8, source->data, source->size);
+    }
+    if (!loaded)
+    {
+        result->outcome = OUTCOME_UNLOADABLE;
+        return;
+    }
+    seed_chip8(&chip8, 1);
+
+    unsigned int instructions_per_frame = INSTRUCTIONS_PER_FRAME;
+    quirk_profile profile = PROFILE_CHIP8;
+    rom_info info;
+    if (settings->has_db && find_rom(&settings->db, chip8.rom_hash, &info))
+    {
+        profile = (quirk_profile)info.profile;
+        instructions_per_frame = info.instructions_per_frame;
+    }
+    chip8.profile = settings->profile_set ? settings->profile : profile;
+
+    hang_detector hang;
+    init_hang_detector(&hang, settings->hang_frames);
+    hang_kind hung = HANG_NONE;
+    instruction instr;
+    uint32_t frame = 0;
+    while (frame < settings->frames && hung == HANG_NONE)
+    {
+        apply_keys(&chip8, scripted_keys(frame));
+        if (chip8.profile == PROFILE_XOCHIP)
+        {
+            run_frame(&chip8, &instr, instructions_per_frame);
+        }
+        else
+        {
+            run_small_ram_frame(&chip8, &instr, instructions_per_frame, result);
+        }
+        frame++;
+        // exits and faults are final even with hang detection off
+        hung = settings->hang_frames || chip8.halted ? check_hang(&hang, &chip8) : HANG_NONE;
+    }
+
+    result->rom_hash = chip8.rom_hash;
+    result->frames = frame;
+    result->pc = hung == HANG_FAULT ? chip8.fault_address : chip8.PC;
+    result->profile = chip8.profile;
+    result->outcome = hung == HANG_FAULT ? OUTCOME_FAULT : (hung != HANG_NONE ? OUTCOME_ENDED : OUTCOME_RAN);
+    result->detail = hung == HANG_FAULT ? chip8.fault : hung;
+}
+
+static void worker(const validate_settings *settings, shared_results *shared)
+{
+    for (;;)
+    {
+        uint32_t i = atomic_fetch_add(&shared->next, 1);
+        if (i >= source_count)
+        {
+            return;
+        }
+        rom_result *result = &shared->results[i];
+        result->worker = getpid();
+        atomic_store(&result->state, STATE_RUNNING);
+        run_rom(settings, &sources[i], result);
+        atomic_store(&result->state, STATE_DONE);
+    }
+}
+
+static pid_t spawn_worker(const validate_settings *settings, shared_results *shared)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        worker(settings, shared);
+        _exit(0);
+    }
+    if (pid < 0)
+    {
+        perror("fork");
+    }
+    return pid;
+}
+
+// run every source over jobs workers, replacing the ones that die
+static bool run_workers(const validate_settings *settings, shared_results *shared, int jobs)
+{
+    int running = 0;
+    for (int i = 0; i < jobs && (uint32_t)i < source_count; i++)
+    {
+        running += spawn_worker(settings, shared) > 0;
+    }
+    if (running == 0)
+    {
+        return false;
+    }
+    while (running > 0)
+    {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+        {
+            perror("wait");
+            return false;
+        }
+        running--;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        {
+            continue; // ran out of work
+        }
+        // the ROM the worker was running is the one that killed it
+        for (uint32_t i = 0; i < source_count; i++)
+        {
+            rom_result *result = &shared->results[i];
+            if (atomic_load(&result->state) == STATE_RUNNING && result->worker == pid)
+            {
+                result->outcome = OUTCOME_CRASHED;
+                result->detail = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+                atomic_store(&result->state, STATE_DONE);
+            }
+        }
+        if (atomic_load(&shared->next) < source_count)
+        {
+            running += spawn_worker(settings, shared) > 0;
+        }
+    }
+    return true;
+}
+
+static void describe(const rom_result *result, char *text, size_t size)
+{
+    switch (result->outcome)
+    {
+    case OUTCOME_RAN:
+        snprintf(text, size, "ran");
+        break;
+    case OUTCOME_ENDED:
+        snprintf(text, size, "%s at %04X", hang_name((hang_kind)result->detail), result->pc);
+        break;
+    case OUTCOME_FAULT:
+        snprintf(text, size, "FAULT: %s at %04X", fault_name((chip8_fault)result->detail), result->pc);
+        break;
+    case OUTCOME_CRASHED:
+        snprintf(text, size, "CRASHED: %s", result->detail ? strsignal(result->detail) : "worker exited");
+        break;
+    default:
+        snprintf(text, size, "unloadable");
+        break;
+    }
+}
+
+static bool is_problem(const rom_result *result)
+{
+    return result->past_small_ram || result->outcome == OUTCOME_FAULT || result->outcome == OUTCOME_CRASHED || result->outcome == OUTCOME_UNLOADABLE
+           || (result->outcome == OUTCOME_ENDED && (result->detail == HANG_STUCK_LOOP || result->detail == HANG_WAIT_KEY));
+}
+
+int main(int argc, char **argv)
+{
+    static validate_settings settings = {.frames = VALIDATE_DEFAULT_FRAMES, .hang_frames = DEFAULT_HANG_FRAMES};
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = cpus > 0 ? (int)cpus : 1;
+    const char *romdb_path = NULL;
+    bool problems_only = false;
+    static rom_archive archives[VALIDATE_MAX_ARCHIVES];
+    int archive_count = 0;
+
+    bool ok = true;
+    for (int i = 1; ok && i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            settings.frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--hang-frames") == 0 && i + 1 < argc)
+            settings.hang_frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            settings.profile_set = parse_profile(argv[++i], &settings.profile);
+            if (!settings.profile_set)
+            {
+                fprintf(stderr, "Unknown profile %s (chip8, schip or xochip)\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--romdb") == 0 && i + 1 < argc)
+            romdb_path = argv[++i];
+        else if (strcmp(argv[i], "--problems") == 0)
+            problems_only = true;
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "usage: %s [--frames N] [--jobs N] [--hang-frames K] [--profile NAME] [--romdb DB] "
+                            "[--problems] DIR|ARCHIVE|ROM...\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            struct stat st;
+            if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+                ok = add_directory(argv[i]);
+            else if (has_suffix(argv[i], ".c8ra") && archive_count == VALIDATE_MAX_ARCHIVES)
+            {
+                fprintf(stderr, "Too many archives, at most %d: %s\n", VALIDATE_MAX_ARCHIVES, argv[i]);
+                ok = false;
+            }
+            else if (has_suffix(argv[i], ".c8ra"))
+                ok = add_archive(argv[i], &archives[archive_count++]);
+            else
+                ok = add_source(argv[i], argv[i], NULL, 0);
+        }
+    }
+    if (!ok)
+    {
+        return EXIT_FAILURE;
+    }
+    if (source_count == 0 || jobs < 1 || jobs > VALIDATE_MAX_JOBS || settings.frames == 0)
+    {
+        fprintf(stderr, "Nothing to validate (need ROMs, --jobs 1-%d and at least one frame)\n", VALIDATE_MAX_JOBS);
+        return EXIT_FAILURE;
+    }
+    settings.has_db = open_romdb(&settings.db, romdb_path ? romdb_path : DEFAULT_ROMDB);
+    if (!settings.has_db && romdb_path)
+    {
+        fprintf(stderr, "Could not open ROM database %s\n", romdb_path);
+        return EXIT_FAILURE;
+    }
+
+    size_t shared_size = sizeof(shared_results) + (size_t)source_count * sizeof(rom_result);
+    shared_results *shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = now_ns();
+    if (!run_workers(&settings, shared, jobs))
+    {
+        return EXIT_FAILURE;
+    }
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    // table, then a count per outcome
+    uint32_t counts[OUTCOME_UNLOADABLE + 1][(int)HANG_KIND_COUNT > (int)FAULT_COUNT ? HANG_KIND_COUNT : FAULT_COUNT] = {{0}};
+    uint64_t frames_run = 0;
+    uint32_t warnings = 0;
+    printf("%-32s %-16s %-7s %7s  %s\n", "rom", "hash", "profile", "frames", "result");
+    for (uint32_t i = 0; i < source_count; i++)
+    {
+        const rom_result *result = &shared->results[i];
+        char text[96];
+        describe(result, text, sizeof(text));
+        if (result->past_small_ram)
+        {
+            size_t length = strlen(text);
+            snprintf(text + length, sizeof(text) - length, ", warning: I past 4kb at %04X", result->past_small_ram_pc);
+        }
+        warnings += result->past_small_ram;
+        frames_run += result->frames;
+        uint8_t detail = result->outcome == OUTCOME_ENDED || result->outcome == OUTCOME_FAULT ? result->detail : 0;
+        counts[result->outcome][detail]++;
+        if (problems_only && !is_problem(result))
+        {
+            continue;
+        }
+        if (result->outcome == OUTCOME_CRASHED || result->outcome == OUTCOME_UNLOADABLE)
+        {
+            printf("%-32.32s %-16s %-7s %7s  %s\n", sources[i].name, "", "", "", text);
+        }
+        else
+        {
+            printf("%-32.32s %016" PRIX64 " %-7s %7u  %s\n", sources[i].name, result->rom_hash,
+                   profile_name((quirk_profile)result->profile), result->frames, text);
+        }
+    }
+
+    printf("\n%u ROMs in %.2fs (%.0f ROMs/s, %.1f million emulated frames/s) on %d workers\n", source_count, seconds,
+           source_count / seconds, frames_run / seconds / 1e6, jobs);
+    printf("  %-40s %u\n", "ran to the end of the budget", counts[OUTCOME_RAN][0]);
+    for (int kind = HANG_EXITED; kind < HANG_KIND_COUNT; kind++)
+    {
+        if (kind != HANG_FAULT)
+        {
+            printf("  %-40s %u\n", hang_name((hang_kind)kind), counts[OUTCOME_ENDED][kind]);
+        }
+    }
+    uint32_t failures = counts[OUTCOME_CRASHED][0] + counts[OUTCOME_UNLOADABLE][0];
+    for (int fault = FAULT_STACK_OVERFLOW; fault < FAULT_COUNT; fault++)
+    {
+        printf("  fault: %-33s %u\n", fault_name((chip8_fault)fault), counts[OUTCOME_FAULT][fault]);
+        failures += counts[OUTCOME_FAULT][fault];
+    }
+    printf("  %-40s %u\n", "crashed", counts[OUTCOME_CRASHED][0]);
+    printf("  %-40s %u\n", "unloadable", counts[OUTCOME_UNLOADABLE][0]);
+    printf("  %-40s %u\n", "warning: I past 4kb (chip8, schip)", warnings);
+
+    munmap(shared, shared_size);
+    for (int i = 0; i < archive_count; i++)
+    {
+        close_archive(&archives[i]);
+    }
+    if (settings.has_db)
+    {
+        close_romdb(&settings.db);
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}